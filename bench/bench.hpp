@@ -0,0 +1,181 @@
+/* Timing and result output for the benchmarks
+ *
+ * Copyright (C) 2016  Jarno Kiviaho <jarkki@kapsi.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+using namespace std;
+
+namespace bench{
+
+  //! Seconds since an arbitrary point
+  inline double now(){
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  //! One measurement: ops operations of a benchmark took seconds
+  struct Result{
+    string group;
+    string name;
+    string params;
+    size_t ops;
+    double seconds;
+
+    double ops_per_second() const{
+      return static_cast<double>(this->ops) / this->seconds;
+    }
+
+    double ns_per_op() const{
+      return 1e9 * this->seconds / static_cast<double>(this->ops);
+    }
+  };
+
+  /*! Command line options shared by the benchmark programs
+   *
+   *    --csv FILE   write the results as CSV
+   *    --json FILE  write the results as JSON
+   *    --quick      smaller problem sizes and shorter runs, for checking that the benchmarks work
+   */
+  struct Options{
+
+    Options(int argc, char *argv[]){
+      this->quick = false;
+      for(int i = 1; i < argc; ++i){
+        if(strcmp(argv[i], "--csv") == 0 && i + 1 < argc){
+          this->csv = argv[++i];
+        }else if(strcmp(argv[i], "--json") == 0 && i + 1 < argc){
+          this->json = argv[++i];
+        }else if(strcmp(argv[i], "--quick") == 0){
+          this->quick = true;
+        }else{
+          throw invalid_argument(string("Unknown option ") + argv[i] + " (use --csv FILE, --json FILE, --quick)");
+        }
+      }
+    }
+
+    //! Minimum time to repeat a micro benchmark for
+    double min_seconds() const{
+      return this->quick ? 0.02 : 0.3;
+    }
+
+    string csv;
+    string json;
+    bool quick;
+  };
+
+  /*! Collects the results, prints them as they come and writes them out at the end
+   *
+   *  Example usage:
+   *  @code
+   *   Recorder recorder(options);
+   *   recorder.time("distribution", "sample_index", "nbins=30", [&](){ sink += d.sample_index(); });
+   *   recorder.write();
+   *  @endcode
+   */
+  class Recorder{
+  public:
+
+    explicit Recorder(const Options & options) : options(options){}
+
+    //! Records a measurement
+    void add(const string & group, const string & name, const string & params, size_t ops, double seconds){
+      Result result = {group, name, params, ops, seconds};
+      this->results.push_back(result);
+      cout << group << "/" << name << " [" << params << "]: "
+           << result.ops_per_second() << " ops/s, " << result.ns_per_op() << " ns/op" << endl;
+    }
+
+    /*! Calls f in batches until the minimum time of the options has passed and records the
+     *   operations per second, counting ops_per_call operations for each call
+     *
+     *  One untimed call warms up the caches first.
+     */
+    template<typename FuncT>
+    void time(const string & group, const string & name, const string & params, FuncT f, size_t ops_per_call = 1){
+      f();
+      size_t calls = 0;
+      size_t batch = 1;
+      double start = now();
+      double elapsed = 0.0;
+      while(elapsed < this->options.min_seconds()){
+        for(size_t i = 0; i < batch; ++i){
+          f();
+        }
+        calls += batch;
+        batch *= 2;
+        elapsed = now() - start;
+      }
+      this->add(group, name, params, ops_per_call * calls, elapsed);
+    }
+
+    //! Writes the results into the files given in the options
+    void write() const{
+      if(!this->options.csv.empty()){
+        ofstream file(this->options.csv);
+        file << "group,name,params,ops,seconds,ops_per_second,ns_per_op" << endl;
+        for(auto & r : this->results){
+          file << r.group << "," << r.name << ",\"" << r.params << "\"," << r.ops << "," << r.seconds << ","
+               << r.ops_per_second() << "," << r.ns_per_op() << endl;
+        }
+      }
+      if(!this->options.json.empty()){
+        ofstream file(this->options.json);
+        file << "[" << endl;
+        for(size_t i = 0; i < this->results.size(); ++i){
+          const Result & r = this->results[i];
+          file << "  {\"group\": \"" << r.group << "\", \"name\": \"" << r.name << "\", \"params\": \"" << r.params
+               << "\", \"ops\": " << r.ops << ", \"seconds\": " << r.seconds
+               << ", \"ops_per_second\": " << r.ops_per_second() << ", \"ns_per_op\": " << r.ns_per_op() << "}"
+               << (i + 1 < this->results.size() ? "," : "") << endl;
+        }
+        file << "]" << endl;
+      }
+    }
+
+    vector<Result> results;
+
+  private:
+    const Options & options;
+  };
+
+  //! "key=value" parameter strings for the results
+  template<typename T>
+  string param(const string & key, const T & value){
+    ostringstream s;
+    s << key << "=" << value;
+    return s.str();
+  }
+
+  inline string params(const string & a, const string & b){
+    return a + " " + b;
+  }
+
+  inline string params(const string & a, const string & b, const string & c){
+    return a + " " + b + " " + c;
+  }
+
+}
@@ -0,0 +1,99 @@
+/* Benchmark: MC control iterations per second as the state space grows
+ *
+ * Copyright (C) 2016  Jarno Kiviaho <jarkki@kapsi.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <armadillo>
+#include <chrono>
+#include <iostream>
+#include "mc-control/utils.hpp"
+#include "mc-control/algorithms.hpp"
+
+using namespace std;
+using namespace arma;
+using namespace mc::utils;
+using namespace mc::algorithms;
+
+/*! Model without constraints, only used for building the possible actions. */
+struct UnconstrainedModel{
+  bool constraint(const double & action, const vec & state) const{
+    return true;
+  }
+};
+
+/*! Minimal stand-in for a DiscretizedModel with an arbitrary number of states.
+ *
+ *  Building a real DiscretizedModel with 10^5 states takes longer than the benchmark itself,
+ *   and the algorithms only need these members.
+ */
+struct SyntheticGrid{
+
+  SyntheticGrid(size_t nstates, size_t nactions){
+    this->state_space_size = nstates;
+    this->nactions = nactions;
+    this->actions = linspace(0.0, 1.0, nactions);
+    this->state_values = linspace(0.0, 1.0, nstates);
+    this->state_value_list.resize(nstates, vec(1));
+    for(size_t state = 0; state < nstates; ++state){
+      this->state_value_list[state](0) = this->state_values(state);
+    }
+  }
+
+  const vec & state_value(const size_t & state) const{
+    return this->state_value_list[state];
+  }
+
+  UnconstrainedModel model;
+  vec actions;
+  size_t nactions;
+  mat state_values;
+  vector<vec> state_value_list;
+  size_t state_space_size;
+};
+
+/*! One-step episode to a random next state, like in the optimal growth example. */
+tuple<uvec,uvec,vec> episode_es(const SyntheticGrid & grid, const size_t & state, const size_t & action, const uvec & pol){
+  uvec states(1);
+  uvec actions(1);
+  vec returns(1);
+  size_t next_state = randint(grid.state_space_size);
+  states(0) = state;
+  actions(0) = action;
+  returns(0) = grid.state_values(next_state) - grid.actions(action);
+  return make_tuple(states, actions, returns);
+}
+
+int main(int argc, char *argv[])
+{
+  mc::rng::seed(42);
+
+  size_t nactions = 30;
+  size_t niterations = 1000000;
+
+  for(size_t nstates : {100, 1000, 10000, 100000}){
+    SyntheticGrid grid(nstates, nactions);
+
+    auto start = chrono::steady_clock::now();
+    run_mc_es(grid, episode_es, niterations);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << "First-visit benchmark: " << nstates << " states, " << nactions << " actions: "
+         << niterations / seconds << " iterations/s" << endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,352 @@
+/* Benchmark suite: the building blocks and the algorithms over a matrix of model sizes
+ *
+ * Copyright (C) 2016  Jarno Kiviaho <jarkki@kapsi.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <armadillo>
+#include <cmath>
+#include <iostream>
+#include "mc-control/utils.hpp"
+#include "mc-control/model.hpp"
+#include "mc-control/distribution.hpp"
+#include "mc-control/episode.hpp"
+#include "mc-control/qtable.hpp"
+#include "mc-control/algorithms.hpp"
+#include "bench/bench.hpp"
+
+using namespace std;
+using namespace arma;
+using namespace mc::utils;
+using namespace mc::models;
+using namespace mc::distributions;
+using namespace mc::episodes;
+using namespace mc::tables;
+using namespace mc::algorithms;
+using namespace bench;
+
+/*! Growth model with N state variables
+ *
+ *  The first variable is income as in the optimal growth example, the others are independent
+ *   log-normal shocks that only make the state space larger.
+ */
+template<uword N>
+struct GrowthModel : StaticModel<GrowthModel<N>, N>{
+
+  typedef typename StaticModel<GrowthModel<N>, N>::state_type state_type;
+
+  GrowthModel(){
+    this->state_lim = mat(N, 2);
+    for(uword var_i = 0; var_i < N; ++var_i){
+      this->state_lim(var_i, 0) = 0.0;
+      this->state_lim(var_i, 1) = 8.0;
+    }
+    this->df = 0.9;
+  }
+
+  void transition(const state_type & state, const double & action, state_type & next_state, Engine & rng) const{
+    next_state(0) = std::pow(action, 0.8) * std::exp(rng.norm());
+    for(uword var_i = 1; var_i < N; ++var_i){
+      next_state(var_i) = 4.0 * std::exp(0.5 * rng.norm());
+    }
+  }
+
+  bool constraint(const double & action, const state_type & state) const{
+    return action <= state(0);
+  }
+
+  double reward(const state_type & state, const double & action, const state_type & next_state) const{
+    return this->immediate_reward(state, action) + this->continuation_reward(action, next_state);
+  }
+
+  double immediate_reward(const state_type & state, const double & action) const{
+    return 1.0 - std::exp(-0.5 * (state(0) - action));
+  }
+
+  double continuation_reward(const double & action, const state_type & next_state) const{
+    return this->df * (1.0 - std::exp(-0.5 * next_state(0)));
+  }
+
+  vec parameters() const{
+    vec params = {this->df};
+    return params;
+  }
+
+  mat state_lim;
+  double df;
+};
+
+//! One-step episode with exploring starts
+template<typename DiscretizedModelT>
+void episode_es(const DiscretizedModelT & discrete_model, const size_t & state, const size_t & action, const uvec & pol, EpisodeBuffer & episode){
+  size_t next_state = discrete_model.distributions[action].sample_index();
+  episode.append(state, action, discrete_model.reward(state, action, next_state));
+}
+
+//! One-step episode following the epsilon-soft policy
+template<typename DiscretizedModelT>
+void episode_soft(const DiscretizedModelT & discrete_model, const uvec & pol, EpisodeBuffer & episode){
+  size_t state = randint(discrete_model.state_space_size);
+  size_t action = pol(state);
+  size_t next_state = discrete_model.distributions[action].sample_index();
+  episode.append(state, action, discrete_model.reward(state, action, next_state));
+}
+
+//! Equally spaced bins on [0, 8] and their midpoints for nvariables variables
+void make_bins(size_t nvariables, size_t nbins, vector<vec> & bins, vector<vec> & bin_values){
+  bins.clear();
+  bin_values.clear();
+  for(size_t var_i = 0; var_i < nvariables; ++var_i){
+    vec edges = linspace(0.0, 8.0, nbins + 1);
+    vec values(nbins);
+    for(size_t bin_i = 0; bin_i < nbins; ++bin_i){
+      values(bin_i) = (edges(bin_i) + edges(bin_i + 1)) / 2.0;
+    }
+    bins.push_back(edges);
+    bin_values.push_back(values);
+  }
+}
+
+/*! Compares the batched samplers with sample_index on the same random stream
+ *
+ *  One action (DiscreteDistribution::sample_indices) and mixed actions (BatchSampler), for batch
+ *   sizes around the block of uniform numbers and the SIMD width.
+ *
+ *  @retval # of states that differ from the scalar loop
+ */
+template<typename RealT>
+size_t check_batch_sampling(){
+  size_t mismatches = 0;
+
+  for(size_t nvariables : {1, 2, 3}){
+    vector<vec> bins, bin_values;
+    make_bins(nvariables, 30, bins, bin_values);
+    vector<BasicDiscreteDistribution<RealT> > distributions;
+    for(size_t action = 0; action < 8; ++action){
+      distributions.push_back(BasicDiscreteDistribution<RealT>(uniform(0.0, 8.0, 10000, nvariables), bins, bin_values));
+    }
+    BasicBatchSampler<RealT> sampler(distributions);
+
+    for(size_t n : {0, 1, 7, 8, 17, 1023, 1024, 1025, 3000}){
+      vector<size_t> actions(n);
+      for(size_t i = 0; i < n; ++i){
+        actions[i] = (i * 5 + i / 3) % distributions.size();
+      }
+      vector<size_t> expected(n), states(n);
+
+      Engine scalar_rng(7, n), batch_rng(7, n);
+      for(size_t i = 0; i < n; ++i){
+        expected[i] = distributions[0].sample_index(scalar_rng);
+      }
+      distributions[0].sample_indices(states.data(), n, batch_rng);
+      for(size_t i = 0; i < n; ++i){
+        mismatches += states[i] != expected[i];
+      }
+
+      for(size_t i = 0; i < n; ++i){
+        expected[i] = distributions[actions[i]].sample_index(scalar_rng);
+      }
+      sampler.sample_indices(actions.data(), states.data(), n, batch_rng);
+      for(size_t i = 0; i < n; ++i){
+        mismatches += states[i] != expected[i];
+      }
+    }
+  }
+  return mismatches;
+}
+
+//! DiscreteDistribution construction and sampling
+void bench_distribution(Recorder & recorder, const Options & options){
+  size_t nsamples = options.quick ? 10000 : 100000;
+  size_t sink = 0;
+
+  for(size_t nvariables : {1, 2, 3}){
+    for(size_t nbins : {10, 30, 100}){
+      string p = params(param("nvariables", nvariables), param("nbins", nbins), param("nsamples", nsamples));
+      vector<vec> bins, bin_values;
+      make_bins(nvariables, nbins, bins, bin_values);
+      mat samples = uniform(0.0, 8.0, nsamples, nvariables);
+
+      recorder.time("distribution", "construct", p, [&](){
+          DiscreteDistribution distribution(samples, bins, bin_values);
+          sink += distribution.nvariables;
+        });
+
+      DiscreteDistribution distribution(samples, bins, bin_values);
+      recorder.time("distribution", "sample_index", p, [&](){
+          for(size_t i = 0; i < 1024; ++i){
+            sink += distribution.sample_index();
+          }
+        }, 1024);
+      recorder.time("distribution", "sample", p, [&](){
+          for(size_t i = 0; i < 1024; ++i){
+            sink += distribution.sample()[0];
+          }
+        }, 1024);
+      vector<size_t> states(1024);
+      recorder.time("distribution", "sample_indices", p, [&](){
+          distribution.sample_indices(states.data(), states.size());
+          sink += states[0];
+        }, 1024);
+
+      // Next states of 1024 pairs with different actions
+      vector<DiscreteDistribution> distributions(8, distribution);
+      BatchSampler sampler(distributions);
+      vector<size_t> actions(1024);
+      for(size_t i = 0; i < actions.size(); ++i){
+        actions[i] = i % distributions.size();
+      }
+      recorder.time("distribution", "batch_sample_indices", p, [&](){
+          sampler.sample_indices(actions.data(), states.data(), states.size());
+          sink += states[0];
+        }, 1024);
+    }
+  }
+  if(sink == 1){
+    cout << endl;
+  }
+}
+
+//! Mapping the bin indices of sampled states to state indices
+void bench_state_index(Recorder & recorder, const Options & options){
+  size_t sink = 0;
+
+  for(size_t nvariables : {1, 2, 3}){
+    for(size_t nbins : {10, 30, 100}){
+      string p = params(param("nvariables", nvariables), param("nbins", nbins));
+      uvec dim(nvariables);
+      dim.fill(nbins);
+      StateIndexer indexer(dim);
+
+      // Random bin indices, in a table that fits in the L1 cache
+      const size_t nstates = 256;
+      vector<size_t> states(nstates * nvariables);
+      for(auto & bin : states){
+        bin = randint(nbins);
+      }
+
+      recorder.time("state_index", "encode", p, [&](){
+          for(size_t i = 0; i < nstates; ++i){
+            sink += indexer.encode(&states[i * nvariables]);
+          }
+        }, nstates);
+    }
+  }
+  if(sink == 1){
+    cout << endl;
+  }
+}
+
+//! Greedy action selection over contiguous and scattered feasible actions
+void bench_argmax_q(Recorder & recorder, const Options & options){
+  const size_t nstates = 1000;
+  size_t sink = 0;
+
+  for(size_t nactions : {10, 30, 100, 300}){
+    QTable<> Q(nstates, nactions);
+    for(size_t state = 0; state < nstates; ++state){
+      for(size_t action = 0; action < nactions; ++action){
+        Q.update(state, action, uniform());
+      }
+    }
+
+    // Feasible actions as the growth model has them (a prefix) and every other action (a bitmask)
+    FeasibleActions prefix(nstates, nactions, [&](size_t state, size_t action){ return action <= state * nactions / nstates; });
+    FeasibleActions scattered(nstates, nactions, [](size_t state, size_t action){ return action % 2 == 0; });
+
+    string p = params(param("nstates", nstates), param("nactions", nactions));
+    recorder.time("argmax_q", "range", p, [&](){
+        for(size_t state = 0; state < nstates; ++state){
+          sink += argmax_q(Q, state, prefix);
+        }
+      }, nstates);
+    recorder.time("argmax_q", "mask", p, [&](){
+        for(size_t state = 0; state < nstates; ++state){
+          sink += argmax_q(Q, state, scattered);
+        }
+      }, nstates);
+  }
+  if(sink == 1){
+    cout << endl;
+  }
+}
+
+/*! DiscretizedModel construction and iterations per second of the algorithms for a model with
+ *   N state variables
+ */
+template<uword N>
+void bench_model(Recorder & recorder, const Options & options){
+  typedef DiscretizedModel<GrowthModel<N> > DiscretizedModelT;
+
+  GrowthModel<N> model;
+  int nsamples = options.quick ? 10000 : 100000;
+  size_t niterations = options.quick ? 100000 : 1000000;
+
+  for(size_t nbins : {10, 30}){
+    for(size_t nactions : {10, 30, 100}){
+      string p = params(param("nvariables", N), param("nbins", nbins), param("nactions", nactions));
+      vec actions = linspace(0.0, 8.0, nactions);
+      uvec bins(N);
+      bins.fill(nbins);
+
+      double start = now();
+      DiscretizedModelT discrete_model(model, actions, bins, nsamples);
+      recorder.add("model", "construct", params(p, param("nsamples", nsamples), param("threads", hardware_threads())),
+                   1, now() - start);
+
+      RunReport report;
+      run_mc_es(discrete_model, episode_es<DiscretizedModelT>, StoppingCriteria(niterations), report,
+                CheckpointConfig(), NullObserver());
+      recorder.add("run_mc_es", "iterations", params(p, param("nstates", discrete_model.state_space_size)),
+                   report.iterations, report.seconds);
+
+      run_mc_eps_soft(discrete_model, episode_soft<DiscretizedModelT>, StoppingCriteria(niterations), report,
+                      0.1, CheckpointConfig(), NullObserver());
+      recorder.add("run_mc_eps_soft", "iterations", params(p, param("nstates", discrete_model.state_space_size)),
+                   report.iterations, report.seconds);
+    }
+  }
+}
+
+/*! Runs the benchmarks
+ *
+ *   bench_suite [--csv FILE] [--json FILE] [--quick]
+ */
+int main(int argc, char *argv[])
+{
+  // The batched samplers must give the states of the scalar one, or the timings mean nothing
+  size_t mismatches = check_batch_sampling<double>() + check_batch_sampling<float>();
+  if(mismatches > 0){
+    cerr << "Batched sampling differs from sample_index in " << mismatches << " states" << endl;
+    return 1;
+  }
+
+  mc::rng::seed(42);
+
+  Options options(argc, argv);
+  Recorder recorder(options);
+
+  bench_distribution(recorder, options);
+  bench_state_index(recorder, options);
+  bench_argmax_q(recorder, options);
+  bench_model<1>(recorder, options);
+  bench_model<2>(recorder, options);
+  bench_model<3>(recorder, options);
+
+  recorder.write();
+
+  return 0;
+}
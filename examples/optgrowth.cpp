@@ -22,13 +22,16 @@
 #include "mc-control/utils.hpp"
 #include "mc-control/model.hpp"
 #include "mc-control/distribution.hpp"
+#include "mc-control/episode.hpp"
 #include "mc-control/algorithms.hpp"
+#include "mc-control/parallel.hpp"
 #include "mc-control/plot.hpp"
 
 using namespace std;
 using namespace arma;
 using namespace mc::utils;
 using namespace mc::models;
+using namespace mc::episodes;
 using namespace mc::algorithms;
 using namespace mc::plot;
 
@@ -43,15 +46,17 @@ using namespace mc::plot;
  *
  *  See Stokey, Nancy, and R. Lucas. "Recursive Methods in Economic Dynamics" (1989).
  *
+ *  The state is one variable (income), so the model derives from StaticModel<OptimalGrowthModel, 1>:
+ *   the states are fixed-size and the model functions are called without virtual dispatch.
+ *
  *  @param param
  *
  *  @retval return type
  *
  *
  */
-struct OptimalGrowthModel : Model{
+struct OptimalGrowthModel : StaticModel<OptimalGrowthModel, 1>{
 
-  size_t nvariables;
   double theta; // Utility func parameter
   double alpha; // Transition func parameter
   double df;    // Discount factor
@@ -70,7 +75,6 @@ struct OptimalGrowthModel : Model{
    *
    */
   OptimalGrowthModel(mat state_lim, double theta = 0.5, double alpha = 0.8, double df = 0.9){
-    this->nvariables = 1;
     this->theta = theta;
     this->alpha = alpha;
     this->df = df;
@@ -82,38 +86,57 @@ struct OptimalGrowthModel : Model{
       y = k^alpha * z,
     where k is the action.
    */
-  vec transition(const vec & state, const double & action) const{
+  void transition(const state_type & state, const double & action, state_type & next_state, Engine & rng) const{
     // Draw a sample from log-norm distribution
-    vec next_state(1);
-    next_state(0) = std::pow(action,this->alpha) * std::exp(mc::utils::norm());
-    return next_state;
+    next_state(0) = std::pow(action,this->alpha) * std::exp(rng.norm());
   };
 
   /*
-    Create a sample of transitions, given the action.
+    Create a sample of transitions, given the action. The normal draws are made in one batch
+    and transformed in place.
    */
-  mat sample_transitions(const double & action, size_t n) const{
-
-    mat samples(n,1);
-    vec state(1); // Doesn't depend on state, but have to pass state anyway
-    for(auto i : range(n)){
-      samples(i,0) = this->transition(state, action)(0);
+  void fill_transitions(const double & action, mat & samples, Engine & rng) const{
+    double * next_states = samples.colptr(0);
+    size_t n = samples.n_rows;
+    double scale = std::pow(action,this->alpha);
+    rng.norm(next_states, n);
+    for(size_t i = 0; i < n; ++i){
+      next_states[i] = scale * std::exp(next_states[i]);
     }
-    return samples;
+  }
+
+  /*
+    Parameters of the model, identifying its cached discretizations.
+  */
+  vec parameters() const{
+    vec params = {this->theta, this->alpha, this->df};
+    return params;
   }
 
   /*
     Returns true if it is possible to take the action from this state.
   */
-  bool constraint(const double & action, const vec & state) const {
+  bool constraint(const double & action, const state_type & state) const {
     return ((this->state_lim[0] <= action) && (action <= state(0))) ? true : false;
   }
 
   /*
     Reward for being in state, taking action and ending in next_state
   */
-  double reward (const vec & state_value, const double & action_value, const vec & next_state_value) const{
-    return U(state_value(0) - action_value) + this->df * U(next_state_value(0));
+  double reward (const state_type & state_value, const double & action_value, const state_type & next_state_value) const{
+    return this->immediate_reward(state_value, action_value) + this->continuation_reward(action_value, next_state_value);
+  }
+
+  /*
+    The reward splits into a part from consuming now and a part from the next state, so the
+    discretized model caches it as two small tables (see DiscretizedModel::precompute_rewards).
+  */
+  double immediate_reward(const state_type & state_value, const double & action_value) const{
+    return U(state_value(0) - action_value);
+  }
+
+  double continuation_reward(const double & action_value, const state_type & next_state_value) const{
+    return this->df * U(next_state_value(0));
   }
 
   /*
@@ -138,30 +161,17 @@ typedef DiscretizedModel<OptimalGrowthModel> DiscretizedOptimalGrowthModel;
  *  @param state          : The state where to start from
  *  @param action         : The randomly selected action to start with
  *  @param pol            : The policy function policy(state)
-  *
- *  @retval Tuple with all states, actions and returns that happened during the episode.
+ *  @param episode        : Buffer where to append the states, actions and returns that happen during the episode.
  */
-tuple<uvec,uvec,vec> episode_es(const DiscretizedOptimalGrowthModel & discrete_model,  const size_t & state,  const size_t & action, const  uvec & pol) {
-
-  uvec states(1);
-  uvec actions(1);
-  vec returns(1);
-  size_t next_state;
-  vector<size_t> std_state_vec;
-
-  states(0) = state;
-  actions(0) = action;
+void episode_es(const DiscretizedOptimalGrowthModel & discrete_model,  const size_t & state,  const size_t & action, const  uvec & pol, EpisodeBuffer & episode) {
 
   // Sample next state
-  std_state_vec = discrete_model.distributions[action].sample();
+  size_t next_state = discrete_model.distributions[action].sample_index();
 
-  // Get the state index from the state-index map
-  next_state = discrete_model.state_index_map.at(std_state_vec);
+  // Reward for being in state, taking action and ending in next_state (a table lookup)
+  double ret = discrete_model.reward(state, action, next_state);
 
-  // Calculate reward for being in state, taking action and ending in next_state
-  returns(0) = discrete_model.model.reward(discrete_model.state_values.row(state), discrete_model.actions(action), discrete_model.state_values.row(next_state));
-
-  return make_tuple(states,actions,returns);
+  episode.append(state, action, ret);
 }
 
 
@@ -172,40 +182,25 @@ tuple<uvec,uvec,vec> episode_es(const DiscretizedOptimalGrowthModel & discrete_m
  *
  *  @param discrete_model : The discretized model
  *  @param soft_pol       : Soft policy.
- *
- *  @retval Tuple with all states, actions and returns that happened during the episode.
+ *  @param episode        : Buffer where to append the states, actions and returns that happen during the episode.
  */
-tuple<uvec,uvec,vec> episode_soft_pol(const DiscretizedOptimalGrowthModel & discrete_model,  const uvec & pol) {
+void episode_soft_pol(const DiscretizedOptimalGrowthModel & discrete_model,  const uvec & pol, EpisodeBuffer & episode) {
 
-  uvec states(1);
-  uvec actions(1);
-  vec returns(1);
-  vec state_value, next_state_value;
   size_t state, action, next_state;
-  vector<size_t> std_state_vec;
-  uvec poss_actions;
 
   // Draw random state
   state = randint(discrete_model.state_space_size);
-  state_value = discrete_model.state_values.row(state);
 
   // Select action with given policy
   action = pol(state);
 
   // Sample next state
-  std_state_vec = discrete_model.distributions[action].sample();
-
-  // Get the state index from the state-index map
-  next_state = discrete_model.state_index_map.at(std_state_vec);
-  next_state_value = discrete_model.state_values.row(next_state);
+  next_state = discrete_model.distributions[action].sample_index();
 
-  // Calculate reward for being in state, taking action and ending in next_state
-  returns(0) = discrete_model.model.reward(state_value, discrete_model.actions(action), next_state_value);
+  // Reward for being in state, taking action and ending in next_state (a table lookup)
+  double ret = discrete_model.reward(state, action, next_state);
 
-  states(0) = state;
-  actions(0) = action;
-
-  return make_tuple(states,actions,returns);
+  episode.append(state, action, ret);
 }
 
 
@@ -217,7 +212,7 @@ tuple<uvec,uvec,vec> episode_soft_pol(const DiscretizedOptimalGrowthModel & disc
 int main(int argc, char *argv[])
 {
   // Seed the rng (randomly)
-  arma_rng::set_seed_random();
+  mc::rng::seed_random();
 
   // State space limits
   mat state_lim = {{0.0, 8.0},};
@@ -233,8 +228,9 @@ int main(int argc, char *argv[])
   vec actions = linspace(state_lim(0,0), state_lim(0,1), nactions);
   //vec actions = linspace(0.5, state_lim(0,1), nactions);
 
-  // Create discretized model from the model
-  DiscretizedModel<OptimalGrowthModel> discrete_model(model, actions, nbins, 100000);
+  // Create discretized model from the model, or load it from the cache if it was created
+  //  with the same parameters before
+  DiscretizedModel<OptimalGrowthModel> discrete_model = load_or_discretize("cache", model, actions, nbins, 100000);
 
   // // Plot the distributions
   // plot_distr(discrete_model.distributions, discrete_model.actions);
@@ -245,7 +241,25 @@ int main(int argc, char *argv[])
   tie(Q,pol) = run_mc_es(discrete_model, episode_es, 5000000);
   //tie(Q,pol) = run_mc_eps_soft(discrete_model, episode_soft_pol, 60000000, 0.1);
 
-  // Plot the Q-values
+  // Episodes of several steps come from an EpisodeRunner (the reward should then leave out the
+  //  discounted continuation value, the runner discounts the later rewards with df)
+  //tie(Q,pol) = run_mc_es(discrete_model, make_episode_runner(discrete_model, 20), 5000000);
+
+  // Or the same on all cores, merging the worker results every 10000 episodes per thread
+  //tie(Q,pol) = run_mc_es_parallel(discrete_model, episode_es, 5000000, ParallelConfig(0, 10000));
+
+  // Or stop when the policy has settled, checkpointing every 1000000 episodes and resuming from the
+  //  checkpoint if the run was interrupted
+  //StoppingCriteria stop(60000000);
+  //stop.policy_stable_checks = 10;
+  //RunReport report;
+  //tie(Q,pol) = run_mc_es(discrete_model, episode_es, stop, report, CheckpointConfig("optgrowth.ckpt", 1000000, true));
+
+  // Or print the counters and the time spent in each phase every 1000000 episodes
+  //tie(Q,pol) = run_mc_es(discrete_model, episode_es, stop, report, CheckpointConfig(), ProgressObserver<true>(1000000, true));
+
+  // Plot the Q-values (or only write them with export_q("q_values.npz", Q, pol, discrete_model)
+  //  and plot later with python/plot.py)
   plot_q(Q,pol,discrete_model);
 
   return 0;
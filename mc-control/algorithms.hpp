@@ -28,17 +28,174 @@
 #include "mc-control/utils.hpp"
 #include "mc-control/distribution.hpp"
 #include "mc-control/model.hpp"
+#include "mc-control/episode.hpp"
+#include "mc-control/qtable.hpp"
+#include "mc-control/stopping.hpp"
+#include "mc-control/checkpoint.hpp"
+#include "mc-control/observer.hpp"
 
 using namespace std;
 using namespace arma;
 using namespace mc::utils;
 using namespace mc::distributions;
 using namespace mc::models;
+using namespace mc::episodes;
+using namespace mc::tables;
+using namespace mc::checkpoints;
 
 namespace mc{
 
   namespace algorithms{
 
+    namespace detail{
+
+      /*! Loads a checkpoint into Q and pol, and the random number state into the engine of this thread
+       *
+       *  Throws if the checkpoint was written for a state-action space of a different size.
+       */
+      template<typename ValueT, typename CountT>
+      size_t resume_from(const string & path, QTable<ValueT,CountT> & Q, uvec & pol){
+        size_t nstates = Q.nstates;
+        size_t nactions = Q.nactions;
+        size_t iterations = load_checkpoint(path, Q, pol, mc::rng::local());
+        if(Q.nstates != nstates || Q.nactions != nactions || pol.n_elem != nstates){
+          throw runtime_error("Checkpoint " + path + " is for a model of a different size");
+        }
+        return iterations;
+      }
+
+      //! Iterations of the checkpoint Q and pol were resumed from, or 0 if there is none to resume
+      template<typename ValueT, typename CountT>
+      size_t resume_run(const CheckpointConfig & checkpoint, QTable<ValueT,CountT> & Q, uvec & pol){
+        if(checkpoint.resume && checkpoint_exists(checkpoint.path)){
+          return resume_from(checkpoint.path, Q, pol);
+        }
+        return 0;
+      }
+
+      //! Checkpoints are written for the dense tables only
+      template<typename ValueT, typename CountT>
+      size_t resume_run(const CheckpointConfig & checkpoint, SparseQTable<ValueT,CountT> & Q, uvec & pol){
+        if(checkpoint.enabled()){
+          throw invalid_argument("Checkpoints are not supported with a SparseQTable");
+        }
+        return 0;
+      }
+
+      template<typename ValueT, typename CountT>
+      void write_checkpoint(const CheckpointConfig & checkpoint, const QTable<ValueT,CountT> & Q, const uvec & pol, size_t iteration){
+        save_checkpoint(checkpoint.path, Q, pol, iteration, mc::rng::local());
+      }
+
+      template<typename ValueT, typename CountT>
+      void write_checkpoint(const CheckpointConfig & checkpoint, const SparseQTable<ValueT,CountT> & Q, const uvec & pol, size_t iteration){}
+    }
+
+
+    namespace detail{
+
+      /*! Loop of run_mc_es over a Q-table and visit tracker of any type
+       *
+       *  Continues from the Q-values in Q and the policy in pol, or from a random policy if pol is
+       *   empty (Q and pol are replaced when resuming from a checkpoint). pol is left with the greedy
+       *   policy.
+       */
+      template<typename DiscretizedModelT, typename EpisodeFuncT, typename ObserverT, typename QTableT, typename VisitsT>
+      void mc_es(const DiscretizedModelT & discrete_model,
+                 EpisodeFuncT & episode,
+                 const StoppingCriteria & stop,
+                 RunReport & report,
+                 const CheckpointConfig & checkpoint,
+                 ObserverT & observer,
+                 QTableT & Q,
+                 VisitsT & visits,
+                 uvec & pol){
+
+        size_t state, action;
+        EpisodeBuffer episode_buffer;
+        FeasibleActions feasible;
+
+        size_t nstates = discrete_model.state_space_size;
+
+        // Init the feasible actions of each state
+        feasible = create_feasible_actions(discrete_model);
+
+        // Init random policy
+        if(pol.n_elem == 0){
+          pol = create_random_policy(feasible);
+        }
+
+        StopMonitor monitor(stop, report);
+
+        // Continue from the checkpoint of a previous run
+        size_t iteration = resume_run(checkpoint, Q, pol);
+        monitor.resume(iteration);
+
+        typename meter_for<ObserverT>::type meter;
+        meter.start(Q, iteration);
+        observer.start(meter.snapshot(iteration));
+
+        // Main iteration loop
+        while(!monitor.done(iteration)){
+          meter.begin();
+
+          // Forget the occurrences of the previous episode
+          visits.new_episode();
+
+          // Draw random starting state
+          state = randint(nstates);
+
+          // Select random action
+          action = feasible.random_action(state);
+
+          // Run episode, starting from state, action and then following policy pol
+          run_episode(episode, discrete_model, state, action, pol, episode_buffer);
+          meter.steps(episode_buffer.size());
+          meter.end(Phase::episode);
+
+          // For each state, action pair in episode
+          for(auto i : range(episode_buffer.size())){
+            size_t s = episode_buffer.states[i];
+            size_t a = episode_buffer.actions[i];
+
+            // If this is first occurrence of state, action (or every occurrence counts)
+            if(episode_buffer.every_visit || visits.first_visit(s,a)){
+
+              // Increase counter and update Q-value (mean of the returns)
+              monitor.q_changed(Q.update(s,a, episode_buffer.returns[i]));
+              meter.pair_updated(Q.count(s,a) == 1);
+            }
+          }
+          meter.end(Phase::update);
+
+          // Update policy to greedy policy
+          for(auto state : episode_buffer.states){
+            size_t greedy = argmax_q(Q,state, feasible);
+            if(pol(state) != greedy){
+              pol(state) = greedy;
+              monitor.policy_changed();
+              meter.policy_changed();
+            }
+          };
+          meter.end(Phase::improve);
+
+          ++iteration;
+
+          if(checkpoint.due(iteration)){
+            write_checkpoint(checkpoint, Q, pol, iteration);
+          }
+
+          if(observer.due(iteration)){
+            observer.report(meter.snapshot(iteration));
+          }
+        }
+
+        if(checkpoint.enabled()){
+          write_checkpoint(checkpoint, Q, pol, iteration);
+        }
+        observer.finish(meter.snapshot(iteration));
+      }
+    }
 
     /*! Monte Carlo control with exploring starts.
      *
@@ -47,196 +204,327 @@ namespace mc{
      *
      *  For an infinite horizon problem (episode length = 1), this reduces to just randomly sampling the state-action space.
      *
+     *  The Q-values and counts are kept in a QTable<ValueT,CountT>, by default doubles and 64-bit
+     *   counts. run_mc_es<float, uint32_t>(...) halves the table, which halves the memory traffic of
+     *   the updates and the greedy action scans. float keeps about 7 significant digits of the mean
+     *   return, enough to rank the actions unless they are closer than that. The increments of a
+     *   pair with millions of returns round away in float, and uint32_t counts up to 4e9 returns.
+     *   The Q-values are returned as a Mat<ValueT> (an fmat for float), so a float run never holds
+     *   a double copy of the table.
+     *
      *  @param discrete_model discretized model
      *  @param episode A function that completes one episode, given the starting state and action and following then the greedy policy. Defined as
      *
      *
+     *    void episodes(const DiscretizedOptimalGrowthModel & discrete_model,
+     *                  const size_t & state,
+     *                  const size_t & action,
+     *                  const  uvec & pol,
+     *                  EpisodeBuffer & episode);
+     *
+     *   appending the steps to the episode buffer, or (slower, allocates every episode)
+     *
      *    tuple<uvec,uvec,vec> episodes(const DiscretizedOptimalGrowthModel & discrete_model,
      *                                  const size_t & state,
      *                                  const size_t & action,
      *                                  const  uvec & pol);
      *
      *
-     *  @param niterations # of Monte Carlo iterations
+     *  @param stop when to stop (see StoppingCriteria)
+     *  @param report filled with the # of iterations run and the reason for stopping
+     *  @param checkpoint where to write checkpoints and whether to resume from one (see CheckpointConfig)
+     *  @param observer gets the counters and timers of the run (see NullObserver)
      *
      *  @retval two-tuple of Q-value matrix and greedy policy vector
      */
-    template<typename DiscretizedModelT, typename EpisodeFuncT>
-    tuple<mat,uvec> run_mc_es(const DiscretizedModelT & discrete_model,
-                              EpisodeFuncT episode,
-                              size_t niterations = 100000){
-
-      uvec poss_actions, episode_states, episode_actions;
-      size_t state, action;
-      vec state_value, qvals, episode_returns;
-      tuple<uvec,uvec,vec> episode_result;
-      vector<uvec> possible_actions;
+    template<typename ValueT = double, typename CountT = uint64_t, typename DiscretizedModelT, typename EpisodeFuncT, typename ObserverT>
+    tuple<Mat<ValueT>,uvec> run_mc_es(const DiscretizedModelT & discrete_model,
+                                      EpisodeFuncT episode,
+                                      const StoppingCriteria & stop,
+                                      RunReport & report,
+                                      const CheckpointConfig & checkpoint,
+                                      ObserverT && observer){
 
       size_t nstates = discrete_model.state_space_size;
       size_t nactions = discrete_model.nactions;
 
-      // Init the matrices for Q-value, counter and returns
-      mat Q = zeros(nstates,nactions);
-      mat counter = zeros(nstates,nactions);
-      mat returns = zeros(nstates,nactions);
-      Mat<int> occurrences;
+      // Init the Q-values and counters
+      QTable<ValueT,CountT> Q(nstates,nactions);
+
+      // First occurrences of state, action pairs in the episode
+      FirstVisitTracker visits(nstates,nactions);
+
+      uvec pol;
+      detail::mc_es(discrete_model, episode, stop, report, checkpoint, observer, Q, visits, pol);
+      return make_tuple(Q.to_mat(), pol);
+    }
+
+    //! Monte Carlo control with exploring starts, printing the progress every 10000 iterations
+    template<typename ValueT = double, typename CountT = uint64_t, typename DiscretizedModelT, typename EpisodeFuncT>
+    tuple<Mat<ValueT>,uvec> run_mc_es(const DiscretizedModelT & discrete_model,
+                                      EpisodeFuncT episode,
+                                      const StoppingCriteria & stop,
+                                      RunReport & report,
+                                      const CheckpointConfig & checkpoint = CheckpointConfig()){
+      return run_mc_es<ValueT,CountT>(discrete_model, episode, stop, report, checkpoint, ProgressObserver<>());
+    }
+
+    //! Monte Carlo control with exploring starts, running niterations iterations
+    template<typename ValueT = double, typename CountT = uint64_t, typename DiscretizedModelT, typename EpisodeFuncT>
+    tuple<Mat<ValueT>,uvec> run_mc_es(const DiscretizedModelT & discrete_model,
+                                      EpisodeFuncT episode,
+                                      size_t niterations = 100000){
+      RunReport report;
+      return run_mc_es<ValueT,CountT>(discrete_model, episode, StoppingCriteria(niterations), report);
+    }
+
+    /*! Monte Carlo control with exploring starts, keeping the Q-values of the visited states only
+     *
+     *
+     *  Same as run_mc_es, but the Q-values are in a SparseQTable and the first visits in a
+     *   HashedVisitTracker, so their memory grows with the visited states instead of the size of the
+     *   state grid. The policy and the feasible actions are still dense (a few words per state).
+     *   Checkpoints are not supported.
+     *
+     *  @retval two-tuple of the sparse Q-table and greedy policy vector
+     */
+    template<typename ValueT = double, typename CountT = uint64_t, typename DiscretizedModelT, typename EpisodeFuncT, typename ObserverT>
+    tuple<SparseQTable<ValueT,CountT>,uvec> run_mc_es_sparse(const DiscretizedModelT & discrete_model,
+                                                 EpisodeFuncT episode,
+                                                 const StoppingCriteria & stop,
+                                                 RunReport & report,
+                                                 ObserverT && observer){
+      SparseQTable<ValueT,CountT> Q(discrete_model.state_space_size, discrete_model.nactions);
+      HashedVisitTracker visits(discrete_model.nactions);
+      uvec pol;
+      detail::mc_es(discrete_model, episode, stop, report, CheckpointConfig(), observer, Q, visits, pol);
+      return make_tuple(std::move(Q), pol);
+    }
+
+    //! Sparse Monte Carlo control with exploring starts, printing the progress every 10000 iterations
+    template<typename ValueT = double, typename CountT = uint64_t, typename DiscretizedModelT, typename EpisodeFuncT>
+    tuple<SparseQTable<ValueT,CountT>,uvec> run_mc_es_sparse(const DiscretizedModelT & discrete_model,
+                                                 EpisodeFuncT episode,
+                                                 const StoppingCriteria & stop,
+                                                 RunReport & report){
+      return run_mc_es_sparse<ValueT,CountT>(discrete_model, episode, stop, report, ProgressObserver<>());
+    }
+
+
+    namespace detail{
+
+      //! Loop of run_mc_eps_soft over a Q-table and visit tracker of any type, see mc_es
+      template<typename DiscretizedModelT, typename EpisodeFuncT, typename ObserverT, typename QTableT, typename VisitsT>
+      void mc_eps_soft(const DiscretizedModelT & discrete_model,
+                       EpisodeFuncT & episode,
+                       const StoppingCriteria & stop,
+                       RunReport & report,
+                       double epsilon,
+                       const CheckpointConfig & checkpoint,
+                       ObserverT & observer,
+                       QTableT & Q,
+                       VisitsT & visits,
+                       uvec & pol){
+
+        EpisodeBuffer episode_buffer;
+        FeasibleActions feasible;
+
+        size_t nstates = discrete_model.state_space_size;
+
+        // Init the feasible actions of each state
+        feasible = create_feasible_actions(discrete_model);
+
+        // Init random policy
+        if(pol.n_elem == 0){
+          pol = create_random_policy(feasible);
+        }
+
+        StopMonitor monitor(stop, report);
+
+        // Continue from the checkpoint of a previous run
+        size_t iteration = resume_run(checkpoint, Q, pol);
+        monitor.resume(iteration);
+
+        // Greedy actions, for noticing when the policy has settled
+        uvec greedy_pol = pol;
 
-      // Init the possible actions matrix
-      possible_actions = create_possible_actions_matrix(discrete_model);
+        typename meter_for<ObserverT>::type meter;
+        meter.start(Q, iteration);
+        observer.start(meter.snapshot(iteration));
 
-      // Init random policy
-      uvec pol = create_random_policy(possible_actions);
+        // Main iteration loop
+        while(!monitor.done(iteration)){
+          meter.begin();
 
-      // Main iteration loop
-      for (auto iteration : range(niterations)){
-        // Occurrences of state, action pairs in the episode (init to zero)
-        occurrences = zeros<Mat<int> >(nstates,nactions);
+          // Forget the occurrences of the previous episode
+          visits.new_episode();
 
-        // Draw random starting state
-        state = randint(nstates);
-        state_value = discrete_model.state_values.row(state);
+          // Generate episode using the epsilon-soft policy
+          run_episode(episode, discrete_model, pol, episode_buffer);
+          meter.steps(episode_buffer.size());
+          meter.end(Phase::episode);
 
-        // Select random action
-        action = possible_actions[state](randint(possible_actions[state].size()));
+          // For each state, action pair in episode
+          for(auto i : range(episode_buffer.size())){
+            size_t s = episode_buffer.states[i];
+            size_t a = episode_buffer.actions[i];
 
-        // Run episode, starting from state, action and then following policy pol
-        tie(episode_states, episode_actions, episode_returns) = episode(discrete_model, state, action, pol);
+            // If this is first occurrence of state, action (or every occurrence counts)
+            if(episode_buffer.every_visit || visits.first_visit(s,a)){
 
-        // For each state, action pair in episode
-        for(auto i : range(episode_states.size())){
-          size_t s = episode_states(i);
-          size_t a = episode_actions(i);
+              // Increase counter and update Q-value (mean of the returns)
+              monitor.q_changed(Q.update(s,a, episode_buffer.returns[i]));
+              meter.pair_updated(Q.count(s,a) == 1);
+            }
+          }
+          meter.end(Phase::update);
 
-          // If this is first occurrence of state, action
-          if(occurrences(s,a) == 0){
+          // Update policy with epsilon-greedy selection
+          for(auto state : episode_buffer.states){
 
-            // Append to returns
-            returns(s,a) += episode_returns(i);
+            // Greedy action for policy
+            size_t greedy = argmax_q(Q, state, feasible);
+            if(greedy_pol(state) != greedy){
+              greedy_pol(state) = greedy;
+              monitor.policy_changed();
+              meter.policy_changed();
+            }
 
-            // Increase counter
-            counter(s,a) += 1;
+            if(uniform() < epsilon){
+              //Random action
+              pol(state) = feasible.random_action(state);
+            }else{
+              pol(state) = greedy;
+            }
+          }
+          meter.end(Phase::improve);
+
+          ++iteration;
 
-            // Update Q-value
-            Q(s,a) = returns(s,a)/counter(s,a);
+          if(checkpoint.due(iteration)){
+            write_checkpoint(checkpoint, Q, pol, iteration);
+          }
 
-            // Mark this state, action pair as occurred
-            occurrences(s,a) = 1;
+          if(observer.due(iteration)){
+            observer.report(meter.snapshot(iteration));
           }
         }
 
-        // Update policy to greedy policy
-        for(auto state : episode_states){
-          pol(state) = argmax_q(Q,state, possible_actions[state]);
-        };
+        // The checkpoint keeps the epsilon-soft policy, so a resumed run continues exploring
+        if(checkpoint.enabled()){
+          write_checkpoint(checkpoint, Q, pol, iteration);
+        }
 
-        // Print info
-        if(iteration % 10000 == 0 && iteration > 0){
-          cout << "Iteration " << iteration << endl;
+        // Calculate greedy policy
+        for(auto state : range(nstates)){
+          pol(state) = argmax_q(Q, state, feasible);
         }
+
+        observer.finish(meter.snapshot(iteration));
       }
-      return make_tuple(Q, pol);
     }
 
-
     /*! Monte Carlo control with epsilon-soft policies.
      *
      *
+     *  The Q-values and counts are kept in a QTable<ValueT,CountT>, see run_mc_es.
+     *
      *  @param discrete_model discretized model
      *  @param episode A function that completes one episode, following then soft policy. Defined as
      *
+     *         void episodes(const DiscretizedOptimalGrowthModel & discrete_model,
+     *                       const  uvec & pol,
+     *                       EpisodeBuffer & episode);
+     *
+     *   appending the steps to the episode buffer, or (slower, allocates every episode)
+     *
      *         tuple<uvec,uvec,vec> episodes(const DiscretizedOptimalGrowthModel & discrete_model,
      *                                       const  uvec & pol);
      *
      *
-     *  @param niterations # of Monte Carlo iterations
+     *  @param stop when to stop (see StoppingCriteria). The policy criterion looks at the greedy part of the policy only.
+     *  @param report filled with the # of iterations run and the reason for stopping
      *  @param epsilon the probability for taking a soft(random) action (instead of greedy action)
+     *  @param checkpoint where to write checkpoints and whether to resume from one (see CheckpointConfig)
+     *  @param observer gets the counters and timers of the run (see NullObserver)
      *
      *  @retval two-tuple of Q-value matrix and greedy policy vector
      *
      */
-    template<typename DiscretizedModelT, typename EpisodeFuncT>
-    tuple<mat,uvec> run_mc_eps_soft(const DiscretizedModelT & discrete_model,
-                                           EpisodeFuncT episode,
-                                           size_t niterations = 100000,
-                                           double epsilon = 0.1){
-
-          Mat<int> occurrences;
-          uvec poss_actions, episode_states, episode_actions;
-          vec state_value, qvals, episode_returns;
-          tuple<uvec,uvec,vec> episode_result;
-          vector<uvec> possible_actions;
+    template<typename ValueT = double, typename CountT = uint64_t, typename DiscretizedModelT, typename EpisodeFuncT, typename ObserverT>
+    tuple<Mat<ValueT>,uvec> run_mc_eps_soft(const DiscretizedModelT & discrete_model,
+                                            EpisodeFuncT episode,
+                                            const StoppingCriteria & stop,
+                                            RunReport & report,
+                                            double epsilon,
+                                            const CheckpointConfig & checkpoint,
+                                            ObserverT && observer){
 
-          size_t nstates = discrete_model.state_space_size;
-          size_t nactions = discrete_model.nactions;
-
-          // Init the matrices for Q-value, counter and returns
-          mat Q = zeros(nstates,nactions);
-          mat counter = zeros(nstates,nactions);
-          mat returns = zeros(nstates,nactions);
-
-          // Init the possible actions matrix
-          possible_actions = create_possible_actions_matrix(discrete_model);
-
-          // Init random policy
-          uvec pol = create_random_policy(possible_actions);
-
-          // Main iteration loop
-          for (auto iteration : range(niterations)){
-
-            // Occurrences of state, action pairs in the episode (init to zero)
-            occurrences = zeros<Mat<int> >(nstates,nactions);
-
-            // Generate episode using the epsilon-soft policy
-            tie(episode_states, episode_actions, episode_returns) = episode(discrete_model, pol);
-
-            // For each state, action pair in episode
-            for(auto i : range(episode_states.size())){
-              size_t s = episode_states(i);
-              size_t a = episode_actions(i);
-
-              // If this is first occurrence of state, action
-              if(occurrences(s,a) == 0){
-
-                // Append to returns
-                returns(s,a) += episode_returns(i);
-
-                // Increase counter
-                counter(s,a) += 1;
-
-                // Update Q-value
-                Q(s,a) = returns(s,a)/counter(s,a);
+      size_t nstates = discrete_model.state_space_size;
+      size_t nactions = discrete_model.nactions;
 
-                // Mark this state, action pair as occurred
-                occurrences(s,a) = 1;
-              }
-            }
+      // Init the Q-values and counters
+      QTable<ValueT,CountT> Q(nstates,nactions);
 
-            // Update policy with epsilon-greedy selection
-            for(auto state : episode_states){
+      // First occurrences of state, action pairs in the episode
+      FirstVisitTracker visits(nstates,nactions);
 
-              if(uniform() < epsilon){
-                //Random action
-                pol(state) = possible_actions[state](randint(possible_actions[state].size()));
-              }else{
-                // Greedy action for policy
-                pol(state) = argmax_q(Q, state, possible_actions[state]);
-              }
-            }
+      uvec pol;
+      detail::mc_eps_soft(discrete_model, episode, stop, report, epsilon, checkpoint, observer, Q, visits, pol);
+      return make_tuple(Q.to_mat(), pol);
+    }
 
-            // Print info
-            if(iteration % 10000 == 0 && iteration > 0){
-              cout << "Iteration " << iteration << endl;
-            }
+    //! Monte Carlo control with epsilon-soft policies, printing the progress every 10000 iterations
+    template<typename ValueT = double, typename CountT = uint64_t, typename DiscretizedModelT, typename EpisodeFuncT>
+    tuple<Mat<ValueT>,uvec> run_mc_eps_soft(const DiscretizedModelT & discrete_model,
+                                            EpisodeFuncT episode,
+                                            const StoppingCriteria & stop,
+                                            RunReport & report,
+                                            double epsilon = 0.1,
+                                            const CheckpointConfig & checkpoint = CheckpointConfig()){
+      return run_mc_eps_soft<ValueT,CountT>(discrete_model, episode, stop, report, epsilon, checkpoint, ProgressObserver<>());
+    }
 
-          }
+    //! Monte Carlo control with epsilon-soft policies, running niterations iterations
+    template<typename ValueT = double, typename CountT = uint64_t, typename DiscretizedModelT, typename EpisodeFuncT>
+    tuple<Mat<ValueT>,uvec> run_mc_eps_soft(const DiscretizedModelT & discrete_model,
+                                            EpisodeFuncT episode,
+                                            size_t niterations = 100000,
+                                            double epsilon = 0.1){
+      RunReport report;
+      return run_mc_eps_soft<ValueT,CountT>(discrete_model, episode, StoppingCriteria(niterations), report, epsilon);
+    }
 
-          // Calculate greedy policy
-          for(auto state : range(nstates)){
-            pol(state) = argmax_q(Q, state, possible_actions[state]);
-          }
+    /*! Monte Carlo control with epsilon-soft policies, keeping the Q-values of the visited states only
+     *
+     *  See run_mc_es_sparse. As in run_mc_eps_soft, the states that were never visited get a random
+     *   feasible action in the returned greedy policy.
+     *
+     *  @retval two-tuple of the sparse Q-table and greedy policy vector
+     */
+    template<typename ValueT = double, typename CountT = uint64_t, typename DiscretizedModelT, typename EpisodeFuncT, typename ObserverT>
+    tuple<SparseQTable<ValueT,CountT>,uvec> run_mc_eps_soft_sparse(const DiscretizedModelT & discrete_model,
+                                                       EpisodeFuncT episode,
+                                                       const StoppingCriteria & stop,
+                                                       RunReport & report,
+                                                       double epsilon,
+                                                       ObserverT && observer){
+      SparseQTable<ValueT,CountT> Q(discrete_model.state_space_size, discrete_model.nactions);
+      HashedVisitTracker visits(discrete_model.nactions);
+      uvec pol;
+      detail::mc_eps_soft(discrete_model, episode, stop, report, epsilon, CheckpointConfig(), observer, Q, visits, pol);
+      return make_tuple(std::move(Q), pol);
+    }
 
-          return make_tuple(Q, pol);
-        }
+    //! Sparse Monte Carlo control with epsilon-soft policies, printing the progress every 10000 iterations
+    template<typename ValueT = double, typename CountT = uint64_t, typename DiscretizedModelT, typename EpisodeFuncT>
+    tuple<SparseQTable<ValueT,CountT>,uvec> run_mc_eps_soft_sparse(const DiscretizedModelT & discrete_model,
+                                                       EpisodeFuncT episode,
+                                                       const StoppingCriteria & stop,
+                                                       RunReport & report,
+                                                       double epsilon = 0.1){
+      return run_mc_eps_soft_sparse<ValueT,CountT>(discrete_model, episode, stop, report, epsilon, ProgressObserver<>());
+    }
 
   }
 }
@@ -0,0 +1,543 @@
+/* Asynchronous parallel algorithms for Monte Carlo optimal control
+ *
+ * Copyright (C) 2016  Jarno Kiviaho <jarkki@kapsi.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <stdexcept>
+#include <exception>
+#include <vector>
+#include <tuple>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include <armadillo>
+#include "mc-control/rng.hpp"
+#include "mc-control/utils.hpp"
+#include "mc-control/model.hpp"
+#include "mc-control/episode.hpp"
+#include "mc-control/qtable.hpp"
+#include "mc-control/stopping.hpp"
+#include "mc-control/observer.hpp"
+
+using namespace std;
+using namespace arma;
+using namespace mc::utils;
+using namespace mc::models;
+using namespace mc::episodes;
+using namespace mc::tables;
+
+namespace mc{
+
+  namespace algorithms{
+
+    /*! Settings for the asynchronous Monte Carlo control algorithms
+     *
+     *  @param nthreads # of threads (0 = one per hardware thread)
+     *  @param batch    # of episodes a thread runs between reports to the stopping criteria and the observer
+     *  @param nstripes # of locks over the states of the shared table, rounded up to a power of two (0 = 256 per thread)
+     */
+    struct AsyncConfig{
+
+      AsyncConfig(size_t nthreads = 0, size_t batch = 1000, size_t nstripes = 0){
+        this->nthreads = nthreads;
+        this->batch = batch;
+        this->nstripes = nstripes;
+      }
+
+      //! Number of threads actually used
+      size_t threads() const{
+        return this->nthreads > 0 ? this->nthreads : hardware_threads();
+      }
+
+      //! Number of stripes actually used
+      size_t stripes() const{
+        size_t wanted = this->nstripes > 0 ? this->nstripes : 256 * this->threads();
+        size_t n = 1;
+        while(n < wanted){
+          n *= 2;
+        }
+        return n;
+      }
+
+      size_t nthreads;
+      size_t batch;
+      size_t nstripes;
+    };
+
+    /*! Contention on the shared table of an asynchronous run
+     *
+     *  Every read and update of a state's Q-values takes the lock of the state's stripe. A contended
+     *   acquisition found the stripe locked by another thread and had to wait. When the contention
+     *   rate grows beyond a few percent the threads mostly wait for each other, and the round-based
+     *   run_mc_es_parallel (or more stripes) is the better choice.
+     */
+    struct ContentionStats{
+
+      ContentionStats(){
+        this->acquisitions = 0;
+        this->contended = 0;
+        this->spins = 0;
+      }
+
+      //! Fraction of the lock acquisitions that had to wait
+      double contention_rate() const{
+        return this->acquisitions > 0 ? static_cast<double>(this->contended) / this->acquisitions : 0.0;
+      }
+
+      void add(const ContentionStats & other){
+        this->acquisitions += other.acquisitions;
+        this->contended += other.contended;
+        this->spins += other.spins;
+      }
+
+      //! # of stripe lock acquisitions
+      size_t acquisitions;
+
+      //! # of acquisitions that found the stripe locked
+      size_t contended;
+
+      //! # of times the waiting threads polled a locked stripe
+      size_t spins;
+    };
+
+    namespace detail{
+
+      //! Spin lock filling a cache line, so that the locks of different stripes never share one
+      struct StripeLock{
+
+        StripeLock(){
+          this->locked.store(false, memory_order_relaxed);
+        }
+
+        //! Takes the lock, returning the # of spins it waited for (0 = uncontended)
+        size_t lock(){
+          if(!this->locked.exchange(true, memory_order_acquire)){
+            return 0;
+          }
+          size_t spins = 1;
+          do{
+            while(this->locked.load(memory_order_relaxed)){
+              spins += 1;
+#if defined(__SSE2__)
+              _mm_pause();
+#endif
+              if(spins % 1024 == 0){
+                std::this_thread::yield();
+              }
+            }
+          }while(this->locked.exchange(true, memory_order_acquire));
+          return spins;
+        }
+
+        void unlock(){
+          this->locked.store(false, memory_order_release);
+        }
+
+        atomic<bool> locked;
+        char padding[64 - sizeof(atomic<bool>)];
+      };
+
+      /*! A QTable updated by several threads in place
+       *
+       *  The states are spread over the stripes by the low bits of the state index, so neighbouring
+       *   states, which the episodes often visit together, have different locks.
+       */
+      template<typename ValueT, typename CountT>
+      class SharedQTable{
+      public:
+
+        SharedQTable(size_t nstates, size_t nactions, size_t nstripes)
+          : Q(nstates, nactions), locks(new StripeLock[nstripes]){
+          this->mask = nstripes - 1;
+        }
+
+        //! Locks the stripe of a state, counting the contention into stats
+        void lock(const size_t & state, ContentionStats & stats){
+          size_t spins = this->locks[state & this->mask].lock();
+          stats.acquisitions += 1;
+          if(spins > 0){
+            stats.contended += 1;
+            stats.spins += spins;
+          }
+        }
+
+        void unlock(const size_t & state){
+          this->locks[state & this->mask].unlock();
+        }
+
+        QTable<ValueT,CountT> Q;
+
+      private:
+        unique_ptr<StripeLock[]> locks;
+        size_t mask;
+      };
+
+      //! Counters of one thread since its last report, and the thread's random stream
+      struct AsyncWorker{
+
+        AsyncWorker(size_t nactions, const Engine & rng) : visits(nactions){
+          this->rng = rng;
+          this->clear();
+        }
+
+        void clear(){
+          this->steps = 0;
+          this->new_pairs = 0;
+          this->policy_changes = 0;
+          this->max_q_change = 0.0;
+        }
+
+        HashedVisitTracker visits;
+        Engine rng;
+        ContentionStats contention;
+        size_t steps;
+        size_t new_pairs;
+        size_t policy_changes;
+        double max_q_change;
+      };
+
+      /*! Runs episodes on several threads, all updating the shared table as they go
+       *
+       *  Each thread claims batches of config.batch episodes until stop.max_iterations are claimed.
+       *   After every episode it adds the returns into the shared table and calls improve(state, worker)
+       *   for the states of the episode, which updates the policy and counts the changes into the
+       *   worker. After every batch the thread reports its counters to the monitor and the meter under
+       *   a mutex, which is also where the run is stopped. There are no barriers: a slow thread holds
+       *   nobody up.
+       *
+       *  @param generate A function writing one episode into an EpisodeBuffer
+       *  @param improve  A function updating pol(state) after an update of the state
+       */
+      template<typename GenerateT, typename ImproveT, typename ValueT, typename CountT, typename MeterT, typename ObserverT>
+      void run_async(GenerateT generate,
+                     ImproveT improve,
+                     const StoppingCriteria & stop,
+                     StopMonitor & monitor,
+                     RunReport & report,
+                     const AsyncConfig & config,
+                     SharedQTable<ValueT,CountT> & shared,
+                     ContentionStats & contention,
+                     MeterT & meter,
+                     ObserverT & observer){
+
+        if(config.batch == 0){
+          throw invalid_argument("AsyncConfig: batch has to be positive");
+        }
+        size_t nthreads = config.threads();
+
+        // Thread t draws from stream t of a seed taken from the calling thread's engine
+        uint64_t run_seed = mc::rng::local()();
+        vector<exception_ptr> errors(nthreads);
+
+        atomic<size_t> claimed(0);
+        atomic<bool> stopped(false);
+        mutex report_mutex;
+        size_t done = 0;
+
+        meter.start(shared.Q, done);
+        observer.start(meter.snapshot(done));
+
+        vector<thread> threads;
+        for(auto t : range(nthreads)){
+          threads.push_back(thread([&, t](){
+                // The counters live on the thread's own stack, away from the cache lines of the others
+                AsyncWorker worker(shared.Q.nactions, Engine(run_seed, t));
+                try{
+                  mc::rng::ScopedEngine bind(worker.rng);
+                  EpisodeBuffer episode_buffer;
+
+                  while(!stopped.load(memory_order_relaxed)){
+                    size_t first = claimed.fetch_add(config.batch);
+                    if(first >= stop.max_iterations){
+                      break;
+                    }
+                    size_t nepisodes = std::min(config.batch, stop.max_iterations - first);
+
+                    for(size_t i = 0; i < nepisodes; ++i){
+                      generate(episode_buffer);
+                      worker.visits.new_episode();
+                      worker.steps += episode_buffer.size();
+
+                      for(auto j : range(episode_buffer.size())){
+                        size_t s = episode_buffer.states[j];
+                        size_t a = episode_buffer.actions[j];
+
+                        // If this is first occurrence of state, action (or every occurrence counts)
+                        if(episode_buffer.every_visit || worker.visits.first_visit(s,a)){
+                          shared.lock(s, worker.contention);
+                          double delta = shared.Q.update(s,a, episode_buffer.returns[j]);
+                          bool first_return = shared.Q.count(s,a) == 1;
+                          shared.unlock(s);
+                          worker.max_q_change = std::max(worker.max_q_change, std::abs(delta));
+                          worker.new_pairs += first_return;
+                        }
+                      }
+
+                      for(auto state : episode_buffer.states){
+                        improve(state, worker);
+                      }
+                    }
+
+                    lock_guard<mutex> guard(report_mutex);
+                    done += nepisodes;
+                    meter.steps(worker.steps);
+                    for(size_t k = 0; k < worker.new_pairs; ++k){
+                      meter.pair_updated(true);
+                    }
+                    for(size_t k = 0; k < worker.policy_changes; ++k){
+                      monitor.policy_changed();
+                      meter.policy_changed();
+                    }
+                    monitor.q_changed(worker.max_q_change);
+                    worker.clear();
+
+                    if(!stopped.load(memory_order_relaxed) && monitor.done(done)){
+                      stopped.store(true, memory_order_relaxed);
+                    }else if(observer.due(done)){
+                      observer.report(meter.snapshot(done));
+                    }
+                  }
+                }catch(...){
+                  errors[t] = current_exception();
+                  stopped.store(true, memory_order_relaxed);
+                }
+                lock_guard<mutex> guard(report_mutex);
+                contention.add(worker.contention);
+              }));
+        }
+        for(auto & t : threads){
+          t.join();
+        }
+        for(auto & error : errors){
+          if(error){
+            rethrow_exception(error);
+          }
+        }
+
+        // The batches in flight when the run was stopped are counted too
+        report.iterations = done;
+        observer.finish(meter.snapshot(done));
+      }
+
+      //! Stores an action into the policy that the episodes of other threads are reading
+      inline void store_action(uvec & pol, const size_t & state, const size_t & action){
+        __atomic_store_n(pol.memptr() + state, static_cast<uword>(action), __ATOMIC_RELAXED);
+      }
+    }
+
+
+    /*! Asynchronous parallel Monte Carlo control with exploring starts.
+     *
+     *
+     *  Same algorithm as run_mc_es, with the episodes run on several threads that all update one
+     *   shared Q-table in place ("Hogwild" style). Each state's Q-values are read and updated under the
+     *   lock of the state's stripe, and each thread improves the policy of the states of its own
+     *   episodes right away. Nothing is copied or merged, so when the threads rarely visit the same
+     *   states at once (large state spaces) this scales better than run_mc_es_parallel, whose merges
+     *   cost memory bandwidth. contention tells how often the threads did collide.
+     *
+     *  The results are not reproducible: they depend on the order in which the threads update the
+     *   table. The episodes read the policy while other threads write it; every entry is written
+     *   atomically, so an episode sees either the old or the new action of a state. The stopping
+     *   criteria are checked after each batch of a thread, and the observer gets no phase times.
+     *
+     *  The Q-values and counts are kept in a QTable<ValueT,CountT> and returned as a Mat<ValueT>, see run_mc_es.
+     *
+     *  @param discrete_model discretized model
+     *  @param episode episode function with the same signature as for run_mc_es, called concurrently
+     *  @param stop when to stop (see StoppingCriteria). Iterations are episodes summed over all threads.
+     *  @param report filled with the # of iterations run and the reason for stopping
+     *  @param config # of threads, batch size and # of lock stripes
+     *  @param contention filled with the lock contention of the run
+     *  @param observer gets the counters of the run after the batches (see NullObserver)
+     *
+     *  @retval two-tuple of Q-value matrix and greedy policy vector
+     */
+    template<typename ValueT = double, typename CountT = uint64_t, typename DiscretizedModelT, typename EpisodeFuncT, typename ObserverT>
+    tuple<Mat<ValueT>,uvec> run_mc_es_async(const DiscretizedModelT & discrete_model,
+                                            EpisodeFuncT episode,
+                                            const StoppingCriteria & stop,
+                                            RunReport & report,
+                                            const AsyncConfig & config,
+                                            ContentionStats & contention,
+                                            ObserverT && observer){
+
+      size_t nstates = discrete_model.state_space_size;
+      size_t nactions = discrete_model.nactions;
+
+      // Shared Q-values and counters
+      detail::SharedQTable<ValueT,CountT> shared(nstates, nactions, config.stripes());
+
+      // Init the feasible actions of each state
+      FeasibleActions feasible = create_feasible_actions(discrete_model);
+
+      // Init random policy
+      uvec pol = create_random_policy(feasible);
+
+      auto generate = [&](EpisodeBuffer & episode_buffer){
+        // Draw random starting state and action
+        size_t state = randint(nstates);
+        size_t action = feasible.random_action(state);
+        run_episode(episode, discrete_model, state, action, pol, episode_buffer);
+      };
+
+      // Update policy to greedy policy
+      auto improve = [&](size_t state, detail::AsyncWorker & worker){
+        shared.lock(state, worker.contention);
+        size_t greedy = argmax_q(shared.Q, state, feasible);
+        if(pol(state) != greedy){
+          detail::store_action(pol, state, greedy);
+          worker.policy_changes += 1;
+        }
+        shared.unlock(state);
+      };
+
+      detail::StopMonitor monitor(stop, report);
+      typename detail::meter_for<ObserverT>::type meter;
+
+      detail::run_async(generate, improve, stop, monitor, report, config, shared, contention, meter, observer);
+
+      return make_tuple(shared.Q.to_mat(), pol);
+    }
+
+    //! Asynchronous Monte Carlo control with exploring starts, printing the progress every 10000 iterations
+    template<typename ValueT = double, typename CountT = uint64_t, typename DiscretizedModelT, typename EpisodeFuncT>
+    tuple<Mat<ValueT>,uvec> run_mc_es_async(const DiscretizedModelT & discrete_model,
+                                            EpisodeFuncT episode,
+                                            const StoppingCriteria & stop,
+                                            RunReport & report,
+                                            const AsyncConfig & config,
+                                            ContentionStats & contention){
+      return run_mc_es_async<ValueT,CountT>(discrete_model, episode, stop, report, config, contention, ProgressObserver<>());
+    }
+
+    //! Asynchronous Monte Carlo control with exploring starts, without the contention statistics
+    template<typename ValueT = double, typename CountT = uint64_t, typename DiscretizedModelT, typename EpisodeFuncT>
+    tuple<Mat<ValueT>,uvec> run_mc_es_async(const DiscretizedModelT & discrete_model,
+                                            EpisodeFuncT episode,
+                                            const StoppingCriteria & stop,
+                                            RunReport & report,
+                                            const AsyncConfig & config = AsyncConfig()){
+      ContentionStats contention;
+      return run_mc_es_async<ValueT,CountT>(discrete_model, episode, stop, report, config, contention);
+    }
+
+
+    /*! Asynchronous parallel Monte Carlo control with epsilon-soft policies.
+     *
+     *
+     *  Same algorithm as run_mc_eps_soft, with the episodes run on several threads that all update one
+     *   shared Q-table. See run_mc_es_async.
+     *
+     *  @param discrete_model discretized model
+     *  @param episode episode function with the same signature as for run_mc_eps_soft, called concurrently
+     *  @param stop when to stop (see run_mc_es_async). The policy criterion looks at the greedy part of the policy only.
+     *  @param report filled with the # of iterations run and the reason for stopping
+     *  @param epsilon the probability for taking a soft(random) action (instead of greedy action)
+     *  @param config # of threads, batch size and # of lock stripes
+     *  @param contention filled with the lock contention of the run
+     *  @param observer gets the counters of the run after the batches (see NullObserver)
+     *
+     *  @retval two-tuple of Q-value matrix and greedy policy vector
+     */
+    template<typename ValueT = double, typename CountT = uint64_t, typename DiscretizedModelT, typename EpisodeFuncT, typename ObserverT>
+    tuple<Mat<ValueT>,uvec> run_mc_eps_soft_async(const DiscretizedModelT & discrete_model,
+                                                  EpisodeFuncT episode,
+                                                  const StoppingCriteria & stop,
+                                                  RunReport & report,
+                                                  double epsilon,
+                                                  const AsyncConfig & config,
+                                                  ContentionStats & contention,
+                                                  ObserverT && observer){
+
+      size_t nstates = discrete_model.state_space_size;
+      size_t nactions = discrete_model.nactions;
+
+      // Shared Q-values and counters
+      detail::SharedQTable<ValueT,CountT> shared(nstates, nactions, config.stripes());
+
+      // Init the feasible actions of each state
+      FeasibleActions feasible = create_feasible_actions(discrete_model);
+
+      // Init random policy
+      uvec pol = create_random_policy(feasible);
+
+      auto generate = [&](EpisodeBuffer & episode_buffer){
+        run_episode(episode, discrete_model, pol, episode_buffer);
+      };
+
+      // Greedy actions, for noticing when the policy has settled. Guarded by the stripe locks.
+      uvec greedy_pol = pol;
+
+      // Update policy with epsilon-greedy selection
+      auto improve = [&](size_t state, detail::AsyncWorker & worker){
+        shared.lock(state, worker.contention);
+        size_t greedy = argmax_q(shared.Q, state, feasible);
+        if(greedy_pol(state) != greedy){
+          greedy_pol(state) = greedy;
+          worker.policy_changes += 1;
+        }
+        shared.unlock(state);
+        detail::store_action(pol, state, uniform() < epsilon ? feasible.random_action(state) : greedy);
+      };
+
+      detail::StopMonitor monitor(stop, report);
+      typename detail::meter_for<ObserverT>::type meter;
+
+      detail::run_async(generate, improve, stop, monitor, report, config, shared, contention, meter, observer);
+
+      // Calculate greedy policy
+      for(auto state : range(nstates)){
+        pol(state) = argmax_q(shared.Q, state, feasible);
+      }
+
+      return make_tuple(shared.Q.to_mat(), pol);
+    }
+
+    //! Asynchronous Monte Carlo control with epsilon-soft policies, printing the progress every 10000 iterations
+    template<typename ValueT = double, typename CountT = uint64_t, typename DiscretizedModelT, typename EpisodeFuncT>
+    tuple<Mat<ValueT>,uvec> run_mc_eps_soft_async(const DiscretizedModelT & discrete_model,
+                                                  EpisodeFuncT episode,
+                                                  const StoppingCriteria & stop,
+                                                  RunReport & report,
+                                                  double epsilon,
+                                                  const AsyncConfig & config,
+                                                  ContentionStats & contention){
+      return run_mc_eps_soft_async<ValueT,CountT>(discrete_model, episode, stop, report, epsilon, config, contention, ProgressObserver<>());
+    }
+
+    //! Asynchronous Monte Carlo control with epsilon-soft policies, without the contention statistics
+    template<typename ValueT = double, typename CountT = uint64_t, typename DiscretizedModelT, typename EpisodeFuncT>
+    tuple<Mat<ValueT>,uvec> run_mc_eps_soft_async(const DiscretizedModelT & discrete_model,
+                                                  EpisodeFuncT episode,
+                                                  const StoppingCriteria & stop,
+                                                  RunReport & report,
+                                                  double epsilon = 0.1,
+                                                  const AsyncConfig & config = AsyncConfig()){
+      ContentionStats contention;
+      return run_mc_eps_soft_async<ValueT,CountT>(discrete_model, episode, stop, report, epsilon, config, contention);
+    }
+
+  }
+}
@@ -0,0 +1,242 @@
+/* Checkpoints of Monte Carlo optimal control runs
+ *
+ * Copyright (C) 2016  Jarno Kiviaho <jarkki@kapsi.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <stdexcept>
+#include <memory>
+#include <armadillo>
+#include "mc-control/io.hpp"
+#include "mc-control/rng.hpp"
+#include "mc-control/qtable.hpp"
+
+using namespace std;
+using namespace arma;
+using namespace mc::tables;
+
+namespace mc{
+
+  namespace checkpoints{
+
+    //! Version of the checkpoint file format
+    const uint32_t checkpoint_version = 1;
+
+    /*! Where and how often the algorithms write checkpoints
+     *
+     *
+     *  With a path set, the algorithm writes a checkpoint every interval iterations (0 = only at the
+     *   end) and at the end of the run. With resume, a run starts from the checkpoint at path if the
+     *   file exists, continuing the iteration count, Q-values, counters, policy and random numbers
+     *   where the checkpoint left them. The stopping criteria count the iterations of all the runs,
+     *   so resuming with a larger max_iterations continues a finished run.
+     *
+     *  Example usage:
+     *  @code
+     *   StoppingCriteria stop(60000000);
+     *   RunReport report;
+     *   CheckpointConfig checkpoint("optgrowth.ckpt", 1000000, true);
+     *   tie(Q,pol) = run_mc_es(discrete_model, episode_es, stop, report, checkpoint);
+     *  @endcode
+     */
+    struct CheckpointConfig{
+
+      CheckpointConfig(const string & path = "", size_t interval = 0, bool resume = false){
+        this->path = path;
+        this->interval = interval;
+        this->resume = resume;
+      }
+
+      //! True if checkpoints are written
+      bool enabled() const{
+        return !this->path.empty();
+      }
+
+      //! True if a checkpoint should be written after the given # of iterations
+      bool due(const size_t & iterations) const{
+        return this->enabled() && this->interval > 0 && iterations % this->interval == 0;
+      }
+
+      string path;
+      size_t interval;
+      bool resume;
+    };
+
+    namespace detail{
+
+      /*! Header of a checkpoint file
+       *
+       *  The file is the header, the state blocks of the QTable exactly as they are in memory and the
+       *   policy as 64-bit integers. The sections start on cache lines, and the file is in the byte order
+       *   of the machine that wrote it.
+       */
+      struct CheckpointHeader{
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint32_t value_bytes;
+        uint32_t count_bytes;
+        uint64_t nstates;
+        uint64_t nactions;
+        uint64_t block_bytes;
+        uint64_t iterations;
+        uint64_t rng_state[4];
+        uint64_t rng_has_spare;
+        double rng_spare;
+        uint64_t table_offset;
+        uint64_t table_bytes;
+        uint64_t policy_offset;
+        uint64_t policy_bytes;
+        unsigned char padding[120];
+      };
+
+      static_assert(sizeof(CheckpointHeader) == 256, "checkpoint header has to be 256 bytes");
+
+      const char checkpoint_magic[8] = {'M','C','C','K','P','T','\0','\0'};
+    }
+
+    //! True if a checkpoint file exists at path
+    inline bool checkpoint_exists(const string & path){
+      return mc::io::file_exists(path);
+    }
+
+    /*! Writes the state of a run into a checkpoint file
+     *
+     *  The file is written next to path and renamed over it when complete, so a run killed while
+     *   writing leaves the previous checkpoint intact.
+     *
+     *  @param path checkpoint file
+     *  @param Q Q-values and visit counts
+     *  @param pol policy
+     *  @param iterations # of iterations run so far
+     *  @param rng random number engine of the run
+     */
+    template<typename ValueT, typename CountT>
+    void save_checkpoint(const string & path,
+                         const QTable<ValueT,CountT> & Q,
+                         const uvec & pol,
+                         const size_t & iterations,
+                         const mc::rng::Engine & rng){
+
+      detail::CheckpointHeader header;
+      std::memset(&header, 0, sizeof(header));
+      std::memcpy(header.magic, detail::checkpoint_magic, sizeof(header.magic));
+      header.version = checkpoint_version;
+      header.byte_order = mc::io::byte_order_mark;
+      header.value_bytes = sizeof(ValueT);
+      header.count_bytes = sizeof(CountT);
+      header.nstates = Q.nstates;
+      header.nactions = Q.nactions;
+      header.block_bytes = Q.block_size();
+      header.iterations = iterations;
+      for(int i = 0; i < 4; ++i){
+        header.rng_state[i] = rng.s[i];
+      }
+      header.rng_has_spare = rng.has_spare ? 1 : 0;
+      header.rng_spare = rng.spare;
+      header.table_offset = sizeof(header);
+      header.table_bytes = Q.nstates * Q.block_size();
+      header.policy_offset = mc::io::round_up(header.table_offset + header.table_bytes, QTable<ValueT,CountT>::alignment);
+      header.policy_bytes = pol.n_elem * sizeof(uint64_t);
+
+      vector<uint64_t> policy(pol.n_elem);
+      for(size_t i = 0; i < pol.n_elem; ++i){
+        policy[i] = pol(i);
+      }
+
+      mc::io::AtomicFile file(path);
+      file.write(&header, sizeof(header));
+      file.write(Q.data(), header.table_bytes);
+      file.pad(QTable<ValueT,CountT>::alignment);
+      file.write(policy.data(), header.policy_bytes);
+      file.commit();
+    }
+
+    /*! Reads the state of a run from a checkpoint file
+     *
+     *  The Q-values and counters are not copied: the file is memory-mapped and Q is made a table over
+     *   the mapping, so loading takes about the same time for any table size, and the pages are read
+     *   when the run first touches them. Updates go to private copies of the pages, the file itself
+     *   is never modified. save_checkpoint replaces the file instead of writing into it, so a run can
+     *   checkpoint into the file it was resumed from.
+     *
+     *  @param path checkpoint file
+     *  @param Q replaced by the Q-values and visit counts of the checkpoint
+     *  @param pol replaced by the policy of the checkpoint
+     *  @param rng set to the state of the engine of the checkpointed run
+     *
+     *  @retval # of iterations run before the checkpoint
+     */
+    template<typename ValueT, typename CountT>
+    size_t load_checkpoint(const string & path,
+                           QTable<ValueT,CountT> & Q,
+                           uvec & pol,
+                           mc::rng::Engine & rng){
+
+      shared_ptr<mc::io::MappedFile> mapping(new mc::io::MappedFile(path));
+      const mc::io::MappedFile & file = *mapping;
+
+      detail::CheckpointHeader header;
+      if(file.size < sizeof(header)){
+        throw runtime_error("Not a checkpoint file: " + path);
+      }
+      std::memcpy(&header, file.data, sizeof(header));
+      if(std::memcmp(header.magic, detail::checkpoint_magic, sizeof(header.magic)) != 0){
+        throw runtime_error("Not a checkpoint file: " + path);
+      }
+      if(header.version != checkpoint_version){
+        throw runtime_error("Unsupported checkpoint version " + to_string(header.version) + " in " + path);
+      }
+      if(header.byte_order != mc::io::byte_order_mark){
+        throw runtime_error("Checkpoint was written on a machine with a different byte order: " + path);
+      }
+      if(header.value_bytes != sizeof(ValueT) || header.count_bytes != sizeof(CountT)){
+        throw runtime_error("Checkpoint has a different Q-value or counter type: " + path);
+      }
+      if(header.table_offset + header.table_bytes > file.size || header.policy_offset + header.policy_bytes > file.size){
+        throw runtime_error("Truncated checkpoint file: " + path);
+      }
+
+      QTable<ValueT,CountT> table(header.nstates, header.nactions, mapping->data + header.table_offset, mapping);
+      if(table.block_size() != header.block_bytes || header.table_bytes != header.nstates * header.block_bytes
+         || header.table_offset % QTable<ValueT,CountT>::alignment != 0){
+        throw runtime_error("Checkpoint has a different table layout: " + path);
+      }
+      Q = std::move(table);
+
+      size_t npol = header.policy_bytes / sizeof(uint64_t);
+      const uint64_t * policy = reinterpret_cast<const uint64_t *>(file.data + header.policy_offset);
+      pol.set_size(npol);
+      for(size_t i = 0; i < npol; ++i){
+        pol(i) = policy[i];
+      }
+
+      for(int i = 0; i < 4; ++i){
+        rng.s[i] = header.rng_state[i];
+      }
+      rng.has_spare = header.rng_has_spare != 0;
+      rng.spare = header.rng_spare;
+
+      return header.iterations;
+    }
+
+  }
+}
@@ -22,6 +22,12 @@
 #include <stdexcept>
 #include <vector>
 #include <tuple>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 #include <armadillo>
 #include "mc-control/utils.hpp"
 
@@ -33,63 +39,563 @@ namespace mc{
 
   namespace distributions{
 
+    /*! Alias table for O(1) sampling from a discrete distribution (Walker's alias method)
+     *
+     *
+     *  https://en.wikipedia.org/wiki/Alias_method
+     *
+     *  Built once in O(n) with Vose's algorithm. A draw uses one uniform number: its integer part
+     *   picks a column and its fractional part decides between the column and its alias, so the cost
+     *   does not depend on the number of outcomes.
+     *
+     *  @tparam RealT type of the stored probabilities (double or float). The table is built in double.
+     */
+    template<typename RealT>
+    class BasicAliasTable{
+    public:
+
+      BasicAliasTable(){}
+
+      /*! Constructor
+       *
+       *  @param weights non-negative (unnormalized) probabilities of the outcomes
+       */
+      BasicAliasTable(const vec & weights){
+
+        size_t n = weights.size();
+        double total = arma::sum(weights);
+        if(n == 0 || !(total > 0.0)){
+          throw invalid_argument("AliasTable: the weights have to contain a positive value");
+        }
+
+        this->prob.assign(n, RealT(1));
+        this->alias.resize(n);
+
+        // Scale the probabilities to mean 1 and split them to under- and overfull columns
+        vector<double> scaled(n);
+        vector<size_t> small, large;
+        for(auto i : range(n)){
+          scaled[i] = weights(i) * n / total;
+          this->alias[i] = i;
+          if(scaled[i] < 1.0){
+            small.push_back(i);
+          }else{
+            large.push_back(i);
+          }
+        }
+
+        // Fill each underfull column with the excess of an overfull one
+        while(!small.empty() && !large.empty()){
+          size_t s = small.back();
+          small.pop_back();
+          size_t l = large.back();
+
+          this->prob[s] = static_cast<RealT>(scaled[s]);
+          this->alias[s] = l;
+
+          scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+          if(scaled[l] < 1.0){
+            large.pop_back();
+            small.push_back(l);
+          }
+        }
+        // The columns left are full up to rounding errors (prob = 1 by initialization)
+      }
+
+      //! Draws an outcome in [0,n-1]
+      size_t sample(Engine & rng) const{
+        size_t n = this->prob.size();
+        double u = rng.uniform() * n;
+        size_t i = static_cast<size_t>(u);
+        if(i >= n){
+          i = n - 1;
+        }
+        return (u - i) < this->prob[i] ? i : this->alias[i];
+      }
+
+      //! Number of outcomes
+      size_t size() const{
+        return this->prob.size();
+      }
+
+      vector<RealT> prob;
+      vector<size_t> alias;
+    };
+
+    //! Alias table of double probabilities
+    typedef BasicAliasTable<double> AliasTable;
+
+    namespace detail{
+
+      //! # of uniform numbers drawn at a time by the batch sampling, small enough to stay in L1
+      const size_t batch_uniforms = 1024;
+
+      //! Lookups of the vectorized path, returns the # of samples done (0 if there is no vectorized path)
+      template<typename RealT>
+      size_t alias_lookup_simd(const RealT * prob, const size_t * alias, size_t n, const size_t * actions,
+                               const double * u, size_t ustride, size_t m, size_t stride, size_t * out){
+        return 0;
+      }
+
+#if defined(__AVX512F__)
+      // The masked forms of the intrinsics with all lanes on compile to the same instructions, and
+      //  avoid the false uninitialized warnings of GCC 12 on the unmasked ones.
+      const __mmask8 all_lanes = 0xFF;
+
+      inline __m512d gather_prob(const double * prob, __m512i columns){
+        return _mm512_mask_i64gather_pd(_mm512_setzero_pd(), all_lanes, columns, prob, 8);
+      }
+
+      inline __m512d gather_prob(const float * prob, __m512i columns){
+        return _mm512_maskz_cvtps_pd(all_lanes, _mm512_mask_i64gather_ps(_mm256_setzero_ps(), all_lanes, columns, prob, 4));
+      }
+
+      // 8 samples at a time. The bins and actions are multiplied as 32-bit lanes.
+      template<typename RealT>
+      size_t alias_lookup_wide(const RealT * prob, const size_t * alias, size_t n, const size_t * actions,
+                               const double * u, size_t ustride, size_t m, size_t stride, size_t * out){
+        const __m512d nd = _mm512_set1_pd(static_cast<double>(n));
+        const __m256i last = _mm256_set1_epi32(static_cast<int>(n - 1));
+        const __m512i nv = _mm512_set1_epi64(static_cast<long long>(n));
+        const __m512i sv = _mm512_set1_epi64(static_cast<long long>(stride));
+        const long long us = static_cast<long long>(ustride);
+        const __m512i uidx = _mm512_set_epi64(7*us, 6*us, 5*us, 4*us, 3*us, 2*us, us, 0);
+        const long long * alias_ll = reinterpret_cast<const long long *>(alias);
+        size_t j = 0;
+        for(; j + 8 <= m; j += 8){
+          __m512d x = ustride == 1 ? _mm512_loadu_pd(u + j)
+            : _mm512_mask_i64gather_pd(_mm512_setzero_pd(), all_lanes, uidx, u + j * ustride, 8);
+          x = _mm512_mul_pd(x, nd);
+          __m256i i32 = _mm256_min_epi32(_mm512_maskz_cvttpd_epi32(all_lanes, x), last);
+          __m512d frac = _mm512_sub_pd(x, _mm512_maskz_cvtepi32_pd(all_lanes, i32));
+          __m512i bin = _mm512_maskz_cvtepi32_epi64(all_lanes, i32);
+          __m512i column = bin;
+          if(actions){
+            column = _mm512_add_epi64(column, _mm512_maskz_mul_epu32(all_lanes, _mm512_loadu_si512(actions + j), nv));
+          }
+          __mmask8 keep = _mm512_cmp_pd_mask(frac, gather_prob(prob, column), _CMP_LT_OQ);
+          __m512i other = _mm512_mask_i64gather_epi64(_mm512_setzero_si512(), all_lanes, column, alias_ll, 8);
+          bin = _mm512_mask_blend_epi64(keep, other, bin);
+          __m512i sum = _mm512_add_epi64(_mm512_loadu_si512(out + j), _mm512_maskz_mul_epu32(all_lanes, bin, sv));
+          _mm512_storeu_si512(out + j, sum);
+        }
+        return j;
+      }
+
+      inline size_t alias_lookup_simd(const double * prob, const size_t * alias, size_t n, const size_t * actions,
+                                      const double * u, size_t ustride, size_t m, size_t stride, size_t * out){
+        return alias_lookup_wide(prob, alias, n, actions, u, ustride, m, stride, out);
+      }
+
+      inline size_t alias_lookup_simd(const float * prob, const size_t * alias, size_t n, const size_t * actions,
+                                      const double * u, size_t ustride, size_t m, size_t stride, size_t * out){
+        return alias_lookup_wide(prob, alias, n, actions, u, ustride, m, stride, out);
+      }
+#elif defined(__AVX2__)
+      inline __m256d gather_prob(const double * prob, __m256i columns){
+        return _mm256_i64gather_pd(prob, columns, 8);
+      }
+
+      inline __m256d gather_prob(const float * prob, __m256i columns){
+        return _mm256_cvtps_pd(_mm256_i64gather_ps(prob, columns, 4));
+      }
+
+      // 4 samples at a time. The bins and actions are multiplied as 32-bit lanes.
+      template<typename RealT>
+      size_t alias_lookup_wide(const RealT * prob, const size_t * alias, size_t n, const size_t * actions,
+                               const double * u, size_t ustride, size_t m, size_t stride, size_t * out){
+        const __m256d nd = _mm256_set1_pd(static_cast<double>(n));
+        const __m128i last = _mm_set1_epi32(static_cast<int>(n - 1));
+        const __m256i nv = _mm256_set1_epi64x(static_cast<long long>(n));
+        const __m256i sv = _mm256_set1_epi64x(static_cast<long long>(stride));
+        const long long us = static_cast<long long>(ustride);
+        const __m256i uidx = _mm256_set_epi64x(3*us, 2*us, us, 0);
+        const long long * alias_ll = reinterpret_cast<const long long *>(alias);
+        size_t j = 0;
+        for(; j + 4 <= m; j += 4){
+          __m256d x = ustride == 1 ? _mm256_loadu_pd(u + j) : _mm256_i64gather_pd(u + j * ustride, uidx, 8);
+          x = _mm256_mul_pd(x, nd);
+          __m128i i32 = _mm_min_epi32(_mm256_cvttpd_epi32(x), last);
+          __m256d frac = _mm256_sub_pd(x, _mm256_cvtepi32_pd(i32));
+          __m256i bin = _mm256_cvtepi32_epi64(i32);
+          __m256i column = bin;
+          if(actions){
+            __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(actions + j));
+            column = _mm256_add_epi64(column, _mm256_mul_epu32(a, nv));
+          }
+          __m256d keep = _mm256_cmp_pd(frac, gather_prob(prob, column), _CMP_LT_OQ);
+          bin = _mm256_blendv_epi8(_mm256_i64gather_epi64(alias_ll, column, 8), bin, _mm256_castpd_si256(keep));
+          __m256i * o = reinterpret_cast<__m256i *>(out + j);
+          _mm256_storeu_si256(o, _mm256_add_epi64(_mm256_loadu_si256(o), _mm256_mul_epu32(bin, sv)));
+        }
+        return j;
+      }
+
+      inline size_t alias_lookup_simd(const double * prob, const size_t * alias, size_t n, const size_t * actions,
+                                      const double * u, size_t ustride, size_t m, size_t stride, size_t * out){
+        return alias_lookup_wide(prob, alias, n, actions, u, ustride, m, stride, out);
+      }
+
+      inline size_t alias_lookup_simd(const float * prob, const size_t * alias, size_t n, const size_t * actions,
+                                      const double * u, size_t ustride, size_t m, size_t stride, size_t * out){
+        return alias_lookup_wide(prob, alias, n, actions, u, ustride, m, stride, out);
+      }
+#endif
+
+      /*! Alias table lookups of m samples: out[j] += stride * bin of sample j
+       *
+       *  The table of sample j starts at column actions[j] * n of prob and alias (the alias entries
+       *   count from the start of the table), or at column 0 if actions is null, and its uniform
+       *   number is u[j * ustride]. The arithmetic is the same as in AliasTable::sample, so the
+       *   vectorized and scalar paths give the same bins.
+       */
+      template<typename RealT>
+      void alias_lookup(const RealT * prob, const size_t * alias, size_t n, const size_t * actions,
+                        const double * u, size_t ustride, size_t m, size_t stride, size_t * out){
+        size_t j = 0;
+        // The vectorized paths convert the bins to int32 and multiply in 32 bits
+        if(n <= INT32_MAX && stride <= UINT32_MAX){
+          j = alias_lookup_simd(prob, alias, n, actions, u, ustride, m, stride, out);
+        }
+        for(; j < m; ++j){
+          double x = u[j * ustride] * n;
+          size_t i = static_cast<size_t>(x);
+          if(i >= n){
+            i = n - 1;
+          }
+          size_t column = (actions ? actions[j] * n : 0) + i;
+          out[j] += ((x - i) < prob[column] ? i : alias[column]) * stride;
+        }
+      }
+
+      /*! Draws the uniform numbers of n samples block by block, sample by sample like n calls of
+       *   sample_index, and calls lookup(variable, u, first, m) for each variable of each block of
+       *   m samples starting at sample first. u of sample first + j is at u[j * nvariables].
+       */
+      template<typename LookupT>
+      void sample_in_blocks(size_t nvariables, size_t * out, size_t n, Engine & rng, LookupT lookup){
+        double buffer[batch_uniforms];
+        vector<double> large;
+        double * u = buffer;
+        size_t block = batch_uniforms / std::max<size_t>(1, nvariables);
+        if(block == 0){
+          large.resize(nvariables);
+          u = large.data();
+          block = 1;
+        }
+        for(size_t first = 0; first < n; first += block){
+          size_t m = std::min(block, n - first);
+          rng.uniform(u, m * nvariables);
+          std::fill(out + first, out + first + m, size_t(0));
+          for(size_t variable = 0; variable < nvariables; ++variable){
+            lookup(variable, u + variable, first, m);
+          }
+        }
+      }
+    }
+
+    /*! Maps values to the bins [edges(i), edges(i+1)) of one variable
+     *
+     *
+     *  Equally spaced edges (like the linspace bins of DiscretizedModel) are detected at
+     *   construction and the bin is then computed arithmetically in O(1). Other edges fall back to
+     *   binary search. Either way the result is the same as checking edges(i) <= x < edges(i+1)
+     *   for every bin.
+     */
+    class Binning{
+    public:
+
+      Binning(const vec & edges){
+        if(edges.size() < 2){
+          throw invalid_argument("Binning: at least two bin edges are needed");
+        }
+        this->edges = &edges;
+        this->nbins = edges.size() - 1;
+        this->lower = edges(0);
+        this->upper = edges(this->nbins);
+        this->dx = (this->upper - this->lower) / this->nbins;
+
+        this->equal_width = true;
+        double tolerance = 1e-9 * std::abs(this->upper - this->lower);
+        for(auto i : range(edges.size())){
+          if(std::abs(edges(i) - (this->lower + i * this->dx)) > tolerance){
+            this->equal_width = false;
+            break;
+          }
+        }
+      }
+
+      //! Sets bin to the index of the bin containing x. Returns false if x is outside the bins.
+      bool index(const double & x, size_t & bin) const{
+        // Also rejects NaN
+        if(!(x >= this->lower && x < this->upper)){
+          return false;
+        }
+        const double * e = this->edges->memptr();
+        if(this->equal_width){
+          bin = std::min(static_cast<size_t>((x - this->lower) / this->dx), this->nbins - 1);
+          // Correct the rounding errors against the actual edges
+          while(bin > 0 && x < e[bin]){
+            --bin;
+          }
+          while(bin + 1 < this->nbins && x >= e[bin+1]){
+            ++bin;
+          }
+        }else{
+          bin = (std::upper_bound(e, e + this->nbins + 1, x) - e) - 1;
+        }
+        return true;
+      }
+
+      bool equal_width;
+
+    private:
+      const vec * edges;
+      size_t nbins;
+      double lower;
+      double upper;
+      double dx;
+    };
+
     /*
       Creates a discrete distribution from a given sample (continuous or discrete) and bins.
       Allows one to draw samples from the resulting discretized distribution.
+
+      RealT is the type of the cumulative distributions, densities and alias tables (double or
+      float). The bins, bin values and histograms stay double, so a distribution of either type
+      is built from and saved as the same numbers. DiscreteDistribution is the double version.
     */
-    class DiscreteDistribution{
+    template<typename RealT>
+    class BasicDiscreteDistribution{
     public:
 
       // TODO: Constructor that constructs the discrete distribution from continuous density function
 
-      DiscreteDistribution(mat samples, vector<vec> bins, vector<vec> bin_values){
+      //! Default constructor (empty distribution)
+      BasicDiscreteDistribution(){
+        this->nvariables = 0;
+      }
 
-        // TODO: Check that the the bins are equally spaced
+      /*! Constructor
+       *
+       *  Bins the samples of each state variable into a histogram, O(nsamples x nvariables) for
+       *   equally spaced bins and O(nsamples x nvariables x log(nbins)) otherwise.
+       *
+       *  \param samples    : (nsamples x nvariables) matrix of samples
+       *  \param bins       : bin edges for each variable, in increasing order
+       *  \param bin_values : values (e.g. midpoints) of the bins for each variable
+       *  \param nthreads   : # of threads for binning the samples (0 = one per hardware thread)
+       *
+       */
+      BasicDiscreteDistribution(const mat & samples, const vector<vec> & bins, const vector<vec> & bin_values, size_t nthreads = 1){
 
-        size_t nvariables = samples.n_cols;;
+        size_t nvariables = samples.n_cols;
         size_t nsamples = samples.n_rows;
 
-        // Initialize histograms to zero
-        vector<vec> hists;
+        vector<Binning> binnings;
         for(auto variable : range(nvariables)){
-          vec hist = arma::zeros(bins[variable].size()-1);
-          hists.push_back(hist);
+          binnings.push_back(Binning(bins[variable]));
         }
 
-        // Create histogram for each state variable
-        for (auto sample : range(nsamples)){
-          // For each state variable in this sample
-          for(auto variable : range(nvariables)){
-            // For each bin
-            for (auto bin_i : range(bins[variable].size()-1)){
-              auto state_value = samples(sample,variable);
-              // If state variable value falls into this bin, increase histogram value for this bin
-              if((bins[variable](bin_i) <= state_value) &&
-                 (state_value < bins[variable](bin_i+1))){
-                hists[variable](bin_i) += 1.0;
-                break;
+        // Create histogram for each state variable. Each thread counts its own block of samples,
+        //  the counts are summed afterwards.
+        if(nthreads == 0){
+          nthreads = hardware_threads();
+        }
+        nthreads = std::max<size_t>(1, std::min(nthreads, nsamples / 10000));
+        vector<vector<vec> > thread_hists(nthreads);
+        parallel_for(nthreads, [&](size_t begin, size_t end){
+            for(size_t t = begin; t < end; ++t){
+              vector<vec> & hists = thread_hists[t];
+              for(auto variable : range(nvariables)){
+                hists.push_back(arma::zeros(bins[variable].size()-1));
               }
+              size_t first = nsamples * t / nthreads;
+              size_t last = nsamples * (t + 1) / nthreads;
+              for(auto variable : range(nvariables)){
+                const Binning & binning = binnings[variable];
+                const double * values = samples.colptr(variable);
+                double * hist = hists[variable].memptr();
+                size_t bin_i;
+                for(size_t sample = first; sample < last; ++sample){
+                  // If state variable value falls into a bin, increase histogram value for this bin
+                  if(binning.index(values[sample], bin_i)){
+                    hist[bin_i] += 1.0;
+                  }
+                }
+              }
+            }
+          }, nthreads);
+
+        vector<vec> hists = thread_hists[0];
+        for(auto t : range(1, nthreads)){
+          for(auto variable : range(nvariables)){
+            hists[variable] += thread_hists[t][variable];
+          }
+        }
+
+        this->init(hists, bins, bin_values);
+      }
+
+      /*! Constructor from histograms
+       *
+       *  Builds the same distribution as the sample constructor from the histograms it counted
+       *   (see histograms), in O(nbins) per variable. Used for loading saved distributions.
+       *
+       *  \param hists      : # of samples in each bin for each variable
+       *  \param bins       : bin edges for each variable, in increasing order
+       *  \param bin_values : values (e.g. midpoints) of the bins for each variable
+       *
+       */
+      BasicDiscreteDistribution(const vector<vec> & hists, const vector<vec> & bins, const vector<vec> & bin_values){
+        this->init(hists, bins, bin_values);
+      }
+
+
+      /*
+        Samples the bin index of each state variable.
+
+       */
+      vector<size_t> sample() const{
+        return this->sample(mc::rng::local());
+      }
+
+      /*
+        Samples the bin index of each state variable with the given random number engine.
+
+       */
+      vector<size_t> sample(Engine & rng) const{
+        vector<size_t> state(this->nvariables);
+        this->sample(state.data(), rng);
+        return state;
+      }
+
+      /*
+        Samples the bin index of each state variable into state[0..nvariables-1].
+        Does not allocate, O(1) per variable regardless of the number of bins.
+
+       */
+      void sample(size_t * state) const{
+        this->sample(state, mc::rng::local());
+      }
+
+      /*
+        Samples the bin index of each state variable into state[0..nvariables-1] with the given
+        random number engine.
+
+       */
+      void sample(size_t * state, Engine & rng) const{
+        for(size_t variable = 0; variable < this->nvariables; ++variable){
+          state[variable] = this->alias_tables[variable].sample(rng);
+        }
+      }
+
+      /*
+        Samples a state and returns its flat index (see StateIndexer), i.e. the row of the state
+        in the state space of DiscretizedModel. Does not allocate.
+
+       */
+      size_t sample_index() const{
+        return this->sample_index(mc::rng::local());
+      }
+
+      /*
+        Samples a state with the given random number engine and returns its flat index.
+
+       */
+      size_t sample_index(Engine & rng) const{
+        size_t index = 0;
+        for(size_t variable = 0; variable < this->nvariables; ++variable){
+          index += this->alias_tables[variable].sample(rng) * this->indexer.strides[variable];
+        }
+        return index;
+      }
+
+      /*
+        Samples n states into out[0..n-1] as flat indices (see sample_index).
+
+       */
+      void sample_indices(size_t * out, size_t n) const{
+        this->sample_indices(out, n, mc::rng::local());
+      }
+
+      /*
+        Samples n states into out[0..n-1] as flat indices with the given random number engine.
+        Gives the same states as n calls of sample_index(rng), but draws the uniform numbers in
+        blocks and looks up the alias tables of several samples at once with AVX-512 or AVX2
+        gathers when compiled for them. Does not allocate.
+
+       */
+      void sample_indices(size_t * out, size_t n, Engine & rng) const{
+        detail::sample_in_blocks(this->nvariables, out, n, rng, [&](size_t variable, const double * u, size_t first, size_t m){
+            const BasicAliasTable<RealT> & table = this->alias_tables[variable];
+            detail::alias_lookup(table.prob.data(), table.alias.data(), table.size(), static_cast<const size_t *>(nullptr),
+                                 u, this->nvariables, m, this->indexer.strides[variable], out + first);
+          });
+      }
+
+      /*
+        Inverse Uniform CDF sampling, O(nbins) per variable. Draws from the same distribution as
+        sample(), kept for reference.
+
+       */
+      vector<size_t> sample_inverse_cdf(Engine & rng) const{
+        vector<size_t> state(this->nvariables);
+        for( auto variable : range(this->nvariables)){
+          double u = rng.uniform();
+          for(auto bin_i : range(this->nbins[variable]-1)){
+            if(u <= this->cumul_distrs[variable](bin_i+1)){
+              state[variable] = bin_i;
+              break;
             }
           }
         }
+        return state;
+      }
+
+      typedef RealT real_type;
+
+      size_t nvariables;
+      vector<size_t> nbins;
+      vector<Col<RealT> > cumul_distrs;
+      vector<vec> bins;
+      vector<vec> bin_values;
+      vec bin_widths;
+      vector<Col<RealT> > densities;
+      vector<BasicAliasTable<RealT> > alias_tables;
+      StateIndexer indexer;
+
+      //! # of samples in each bin for each variable
+      vector<vec> histograms;
+
+    private:
+
+      void init(const vector<vec> & hists, const vector<vec> & bins, const vector<vec> & bin_values){
+
+        size_t nvariables = hists.size();
 
         // Create cumulative distributions and densities
-        vector<vec> cumul_distrs;
-        vector<vec> densities;
+        vector<Col<RealT> > cumul_distrs;
+        vector<Col<RealT> > densities;
         vec bin_widths(nvariables);
         for(auto variable : range(nvariables)){
 
           // Normalize the histograms integrate to 1 (create densities)
-          vec density = arma::zeros(bins[variable].size()-1);
+          size_t nbins_var = bins[variable].size()-1;
+          double total = arma::sum(hists[variable]);
+          vec mass = hists[variable]/total;
+          vec density(nbins_var);
+          for(auto bin_i : range(nbins_var)){
+            density(bin_i) = mass(bin_i)/(bins[variable](bin_i+1) - bins[variable](bin_i));
+          }
           double dx = bins[variable](1) - bins[variable](0);
-          density = hists[variable]/(arma::sum(hists[variable]) * dx);
 
           // Calculate cumulative distribution function
           vec cum_distr = arma::zeros(bins[variable].size());
-          cum_distr(span(1,cum_distr.size()-1)) = arma::cumsum(density * dx);
+          cum_distr(span(1,cum_distr.size()-1)) = arma::cumsum(mass);
 
-          cumul_distrs.push_back(cum_distr);
-          densities.push_back(density);
+          cumul_distrs.push_back(conv_to<Col<RealT> >::from(cum_distr));
+          densities.push_back(conv_to<Col<RealT> >::from(density));
           bin_widths(variable) = dx;
         }
 
@@ -99,6 +605,18 @@ namespace mc{
           nbins[variable] = bins[variable].size();
         }
 
+        // Flat state indexing, see sample_index()
+        uvec nbins_vars(nvariables);
+        for(auto variable : range(nvariables)){
+          nbins_vars(variable) = bins[variable].size()-1;
+        }
+
+        // Alias tables for sampling the bins in O(1)
+        vector<BasicAliasTable<RealT> > alias_tables;
+        for(auto variable : range(nvariables)){
+          alias_tables.push_back(BasicAliasTable<RealT>(hists[variable]));
+        }
+
         this->nvariables = nvariables;
         this->cumul_distrs = cumul_distrs;
         this->nbins = nbins;
@@ -106,41 +624,98 @@ namespace mc{
         this->bin_values = bin_values;
         this->bin_widths = bin_widths;
         this->densities = densities;
+        this->alias_tables = alias_tables;
+        this->indexer = StateIndexer(nbins_vars);
+        this->histograms = hists;
       }
+    };
 
+    //! Discrete distribution in double precision, BasicDiscreteDistribution<float> for float
+    typedef BasicDiscreteDistribution<double> DiscreteDistribution;
 
-      /*
-        Inverse Uniform CDF sampling.
 
+    /*! The distributions of the next state for all actions, for sampling many next states at once
+     *
+     *
+     *  The alias tables of a state variable are laid out one action after another in one array,
+     *   so the lookups of samples with different actions are gathers from the same array. Built
+     *   from the DiscreteDistributions of the actions (see DiscretizedModel::sample_next_states).
+     *
+     *  Example usage:
+     *  @code
+     *   BatchSampler sampler(discrete_model.distributions);
+     *   sampler.sample_indices(actions.data(), next_states.data(), actions.size(), rng);
+     *  @endcode
+     */
+    template<typename RealT>
+    class BasicBatchSampler{
+    public:
+
+      BasicBatchSampler(){
+        this->nvariables = 0;
+        this->nactions = 0;
+      }
+
+      /*! Constructor
+       *
+       *  @param distributions distribution of the next state for each action, over the same bins
        */
-      vector<size_t> sample() const{
-        vector<size_t> state(this->nvariables);
-        auto u = uniform(this->nvariables);
-        for( auto variable : range(this->nvariables)){
-          for(auto bin_i : range(this->nbins[variable])){
-            if(u(variable) <= this->cumul_distrs[variable](bin_i+1)){
-              state[variable] = bin_i;
-              break;
+      BasicBatchSampler(const vector<BasicDiscreteDistribution<RealT> > & distributions){
+        this->nactions = distributions.size();
+        this->nvariables = this->nactions > 0 ? distributions[0].nvariables : 0;
+        if(this->nactions > UINT32_MAX){
+          throw invalid_argument("BatchSampler: too many actions");
+        }
+        this->prob.resize(this->nvariables);
+        this->alias.resize(this->nvariables);
+        for(auto variable : range(this->nvariables)){
+          this->ncolumns.push_back(distributions[0].alias_tables[variable].size());
+          this->strides.push_back(distributions[0].indexer.strides[variable]);
+          for(auto & distribution : distributions){
+            const BasicAliasTable<RealT> & table = distribution.alias_tables[variable];
+            if(table.size() != this->ncolumns[variable]){
+              throw invalid_argument("BatchSampler: the distributions have different bins");
             }
-            // if((this->cumul_distrs[variable](bin_i) <= u(variable)) &&
-            //    (u(variable) < this->cumul_distrs[variable](bin_i+1))){
-            //   state[variable] = bin_i;
-            //   break;
-            // }
+            this->prob[variable].insert(this->prob[variable].end(), table.prob.begin(), table.prob.end());
+            this->alias[variable].insert(this->alias[variable].end(), table.alias.begin(), table.alias.end());
           }
         }
-        return state;
+      }
+
+      //! Samples the next state after actions[j] into out[j] for j < n, as flat indices
+      void sample_indices(const size_t * actions, size_t * out, size_t n) const{
+        this->sample_indices(actions, out, n, mc::rng::local());
+      }
+
+      /*! Samples the next state after actions[j] into out[j] for j < n, as flat indices
+       *
+       *  Gives the same states as distributions[actions[j]].sample_index(rng) for j = 0..n-1, in
+       *   one pass over a block of uniform numbers per state variable. Does not allocate.
+       */
+      void sample_indices(const size_t * actions, size_t * out, size_t n, Engine & rng) const{
+        detail::sample_in_blocks(this->nvariables, out, n, rng, [&](size_t variable, const double * u, size_t first, size_t m){
+            detail::alias_lookup(this->prob[variable].data(), this->alias[variable].data(), this->ncolumns[variable], actions + first,
+                                 u, this->nvariables, m, this->strides[variable], out + first);
+          });
       }
 
       size_t nvariables;
-      vector<size_t> nbins;
-      vector<vec> cumul_distrs;
-      vector<vec> bins;
-      vector<vec> bin_values;
-      vec bin_widths;
-      vector<vec> densities;
+      size_t nactions;
+
+      //! # of bins of each variable, the columns of the alias table of an action
+      vector<size_t> ncolumns;
+
+      //! Stride of each variable in the flat state index
+      vector<size_t> strides;
+
+      //! Alias tables of all actions for each variable, action a at columns [a*ncolumns, (a+1)*ncolumns)
+      vector<vector<RealT> > prob;
+      vector<vector<size_t> > alias;
     };
 
+    //! Batch sampler of double distributions
+    typedef BasicBatchSampler<double> BatchSampler;
+
   }
 
 }
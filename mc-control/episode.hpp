@@ -0,0 +1,348 @@
+/* Episode buffers and runners for Monte Carlo optimal control
+ *
+ * Copyright (C) 2016  Jarno Kiviaho <jarkki@kapsi.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <vector>
+#include <tuple>
+#include <stdexcept>
+#include <armadillo>
+#include "mc-control/utils.hpp"
+
+using namespace std;
+using namespace arma;
+using namespace mc::utils;
+
+namespace mc{
+
+  namespace episodes{
+
+    /*! States, actions and returns of one episode
+     *
+     *
+     *  The algorithms own one buffer, clear it before each episode and pass it to the episode
+     *   function, which appends one entry per step. Clearing keeps the capacity, so after the first
+     *   few episodes no memory is allocated.
+     *
+     *  Example usage (episode function for run_mc_es):
+     *  @code
+     *   void episode_es(const DiscretizedOptimalGrowthModel & discrete_model, const size_t & state,
+     *                   const size_t & action, const uvec & pol, EpisodeBuffer & episode){
+     *     size_t next_state = discrete_model.distributions[action].sample_index();
+     *     episode.append(state, action, reward(state, action, next_state));
+     *   }
+     *  @endcode
+     */
+    class EpisodeBuffer{
+    public:
+
+      EpisodeBuffer(size_t capacity = 16){
+        this->reserve(capacity);
+        this->every_visit = false;
+      }
+
+      //! Removes all steps, keeping the memory
+      void clear(){
+        this->states.clear();
+        this->actions.clear();
+        this->returns.clear();
+      }
+
+      //! Reserves memory for n steps
+      void reserve(size_t n){
+        this->states.reserve(n);
+        this->actions.reserve(n);
+        this->returns.reserve(n);
+      }
+
+      //! Appends one step of the episode
+      void append(const size_t & state, const size_t & action, const double & ret){
+        this->states.push_back(state);
+        this->actions.push_back(action);
+        this->returns.push_back(ret);
+      }
+
+      //! Replaces the contents with an episode in the tuple<uvec,uvec,vec> format
+      void assign(const tuple<uvec,uvec,vec> & episode){
+        const uvec & episode_states = get<0>(episode);
+        const uvec & episode_actions = get<1>(episode);
+        const vec & episode_returns = get<2>(episode);
+        this->clear();
+        for(auto i : range(episode_states.size())){
+          this->append(episode_states(i), episode_actions(i), episode_returns(i));
+        }
+      }
+
+      //! Number of steps
+      size_t size() const{
+        return this->states.size();
+      }
+
+      vector<size_t> states;
+      vector<size_t> actions;
+      vector<double> returns;
+
+      /*! If true, the algorithms average the returns of every visit of a state, action pair in the
+       *   episode instead of only the first one. Set by the episode function; clear() keeps it.
+       */
+      bool every_visit;
+    };
+
+    //! Which visits of a state, action pair in an episode are averaged into its Q-value
+    enum class VisitMode{
+      first_visit,  //!< only the first visit in each episode
+      every_visit   //!< every visit
+    };
+
+    namespace detail{
+
+      // Dispatch between the two kinds of episode functions. The int overloads (buffer) are
+      //  preferred over the long ones (tuple) when both compile.
+
+      template<typename EpisodeFuncT, typename DiscretizedModelT>
+      auto run_episode_es(EpisodeFuncT & episode, const DiscretizedModelT & discrete_model,
+                          const size_t & state, const size_t & action, const uvec & pol,
+                          EpisodeBuffer & buffer, int)
+        -> decltype(episode(discrete_model, state, action, pol, buffer), void()){
+        buffer.clear();
+        episode(discrete_model, state, action, pol, buffer);
+      }
+
+      template<typename EpisodeFuncT, typename DiscretizedModelT>
+      void run_episode_es(EpisodeFuncT & episode, const DiscretizedModelT & discrete_model,
+                          const size_t & state, const size_t & action, const uvec & pol,
+                          EpisodeBuffer & buffer, long){
+        buffer.assign(episode(discrete_model, state, action, pol));
+      }
+
+      template<typename EpisodeFuncT, typename DiscretizedModelT>
+      auto run_episode_soft(EpisodeFuncT & episode, const DiscretizedModelT & discrete_model,
+                            const uvec & pol, EpisodeBuffer & buffer, int)
+        -> decltype(episode(discrete_model, pol, buffer), void()){
+        buffer.clear();
+        episode(discrete_model, pol, buffer);
+      }
+
+      template<typename EpisodeFuncT, typename DiscretizedModelT>
+      void run_episode_soft(EpisodeFuncT & episode, const DiscretizedModelT & discrete_model,
+                            const uvec & pol, EpisodeBuffer & buffer, long){
+        buffer.assign(episode(discrete_model, pol));
+      }
+    }
+
+    /*! Runs an exploring starts episode function into the buffer
+     *
+     *  The episode function is either
+     *
+     *    void episode(const DiscretizedModelT & discrete_model, const size_t & state, const size_t & action,
+     *                 const uvec & pol, EpisodeBuffer & buffer);
+     *
+     *  which appends the steps to the (cleared) buffer, or the older
+     *
+     *    tuple<uvec,uvec,vec> episode(const DiscretizedModelT & discrete_model, const size_t & state,
+     *                                 const size_t & action, const uvec & pol);
+     *
+     *  whose result is copied into the buffer.
+     */
+    template<typename EpisodeFuncT, typename DiscretizedModelT>
+    void run_episode(EpisodeFuncT & episode, const DiscretizedModelT & discrete_model,
+                     const size_t & state, const size_t & action, const uvec & pol,
+                     EpisodeBuffer & buffer){
+      detail::run_episode_es(episode, discrete_model, state, action, pol, buffer, 0);
+    }
+
+    /*! Runs a soft policy episode function into the buffer
+     *
+     *  The episode function is either
+     *
+     *    void episode(const DiscretizedModelT & discrete_model, const uvec & pol, EpisodeBuffer & buffer);
+     *
+     *  or the older
+     *
+     *    tuple<uvec,uvec,vec> episode(const DiscretizedModelT & discrete_model, const uvec & pol);
+     */
+    template<typename EpisodeFuncT, typename DiscretizedModelT>
+    void run_episode(EpisodeFuncT & episode, const DiscretizedModelT & discrete_model,
+                     const uvec & pol, EpisodeBuffer & buffer){
+      detail::run_episode_soft(episode, discrete_model, pol, buffer, 0);
+    }
+
+    namespace detail{
+
+      // Discount factor of the model (its df member), 1 if it has none
+      template<typename ModelT>
+      auto model_discount(const ModelT & model, int) -> decltype(static_cast<double>(model.df)){
+        return model.df;
+      }
+
+      template<typename ModelT>
+      double model_discount(const ModelT & model, long){
+        return 1.0;
+      }
+
+      // True if the model has a terminal(state) function
+      template<typename ModelT, typename StateT>
+      auto has_terminal(const ModelT & model, const StateT & state, int) -> decltype(model.terminal(state), bool()){
+        return true;
+      }
+
+      template<typename ModelT, typename StateT>
+      bool has_terminal(const ModelT & model, const StateT & state, long){
+        return false;
+      }
+
+      template<typename ModelT, typename StateT>
+      auto is_terminal(const ModelT & model, const StateT & state, int) -> decltype(model.terminal(state), bool()){
+        return model.terminal(state);
+      }
+
+      template<typename ModelT, typename StateT>
+      bool is_terminal(const ModelT & model, const StateT & state, long){
+        return false;
+      }
+    }
+
+    /*! Multi-step episodes of a discretized model, for run_mc_es and run_mc_eps_soft and their
+     *   parallel versions
+     *
+     *
+     *  An episode starts from a state and action (exploring starts) or from a uniformly drawn
+     *   state and the action of the policy (soft policies), and then follows the policy for up to
+     *   horizon steps, stopping early when it enters a terminal state. Each step samples the next
+     *   state from the distribution of the action and appends the reward to the (cleared) buffer.
+     *   At the end one backward pass replaces the rewards with the discounted returns,
+     *
+     *    G_t = r_t + discount * G_{t+1},
+     *
+     *  in place. Nothing is reserved up front: a reused buffer keeps its capacity, so once it has
+     *   grown to the longest episode seen, nothing is allocated, and a large horizon costs no
+     *   memory unless the episodes actually get that long.
+     *
+     *  The discount is the df member of the model, or 1 if it has none. Terminal states are the
+     *   states for which the model's terminal(state_value) returns true, looked up from a table
+     *   built once in the constructor. Without a terminal function every episode runs horizon steps.
+     *   With one, the horizon is a safety cap: an early policy can cycle among non-terminal states
+     *   forever, and the cap cuts such episodes off instead of growing the buffer without bound.
+     *
+     *  With VisitMode::every_visit the algorithms average the returns of every visit of a state,
+     *   action pair, otherwise only the first visit in each episode.
+     *
+     *  Example usage:
+     *  @code
+     *   auto episode = make_episode_runner(discrete_model, 50);
+     *   tie(Q,pol) = run_mc_es(discrete_model, episode, 1000000);
+     *  @endcode
+     *
+     *  The runner is not modified by the episodes, so the parallel algorithms can share it.
+     */
+    template<typename DiscretizedModelT>
+    class EpisodeRunner{
+    public:
+
+      /*! Constructor
+       *
+       *  @param discrete_model the discretized model
+       *  @param horizon        maximum # of steps, positive (with terminal states, a cap on the episode length)
+       *  @param discount       discount factor of the returns
+       *  @param mode           first-visit or every-visit returns
+       */
+      EpisodeRunner(const DiscretizedModelT & discrete_model, size_t horizon, double discount,
+                    VisitMode mode = VisitMode::first_visit){
+        if(horizon == 0){
+          throw invalid_argument("EpisodeRunner: the horizon has to be positive");
+        }
+        this->horizon = horizon;
+        this->discount = discount;
+        this->mode = mode;
+
+        size_t nstates = discrete_model.state_space_size;
+        bool has_terminal = nstates > 0 && detail::has_terminal(discrete_model.model, discrete_model.state_value(0), 0);
+        if(has_terminal){
+          this->terminal.resize(nstates);
+          for(size_t state = 0; state < nstates; ++state){
+            this->terminal[state] = detail::is_terminal(discrete_model.model, discrete_model.state_value(state), 0) ? 1 : 0;
+          }
+        }
+      }
+
+      //! Constructor with the discount factor of the model
+      EpisodeRunner(const DiscretizedModelT & discrete_model, size_t horizon, VisitMode mode = VisitMode::first_visit)
+        : EpisodeRunner(discrete_model, horizon, detail::model_discount(discrete_model.model, 0), mode){}
+
+      //! Episode with exploring starts: takes action in state, then follows pol
+      void operator()(const DiscretizedModelT & discrete_model, const size_t & state, const size_t & action,
+                      const uvec & pol, EpisodeBuffer & episode) const{
+        this->run(discrete_model, state, action, pol, episode);
+      }
+
+      //! Episode following pol from a uniformly drawn state
+      void operator()(const DiscretizedModelT & discrete_model, const uvec & pol, EpisodeBuffer & episode) const{
+        size_t state = randint(discrete_model.state_space_size);
+        this->run(discrete_model, state, pol(state), pol, episode);
+      }
+
+      //! True if the episodes end when entering the state
+      bool is_terminal(const size_t & state) const{
+        return !this->terminal.empty() && this->terminal[state] != 0;
+      }
+
+      size_t horizon;
+      double discount;
+      VisitMode mode;
+
+    private:
+
+      void run(const DiscretizedModelT & discrete_model, size_t state, size_t action,
+               const uvec & pol, EpisodeBuffer & episode) const{
+
+        episode.clear();
+        episode.every_visit = this->mode == VisitMode::every_visit;
+
+        // Forward pass: states, actions and rewards
+        for(size_t t = 0; t < this->horizon; ++t){
+          size_t next_state = discrete_model.distributions[action].sample_index();
+          episode.append(state, action, discrete_model.reward(state, action, next_state));
+          if(this->is_terminal(next_state)){
+            break;
+          }
+          state = next_state;
+          action = pol(state);
+        }
+
+        // Backward pass: rewards to discounted returns
+        double ret = 0.0;
+        for(size_t t = episode.size(); t-- > 0;){
+          ret = episode.returns[t] + this->discount * ret;
+          episode.returns[t] = ret;
+        }
+      }
+
+      //! 1 for terminal states, empty if the model has none
+      vector<unsigned char> terminal;
+    };
+
+    //! EpisodeRunner with the discount factor of the model
+    template<typename DiscretizedModelT>
+    EpisodeRunner<DiscretizedModelT> make_episode_runner(const DiscretizedModelT & discrete_model, size_t horizon,
+                                                         VisitMode mode = VisitMode::first_visit){
+      return EpisodeRunner<DiscretizedModelT>(discrete_model, horizon, mode);
+    }
+
+  }
+}
@@ -0,0 +1,220 @@
+/* File helpers for Monte Carlo optimal control
+ *
+ * Copyright (C) 2016  Jarno Kiviaho <jarkki@kapsi.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace mc{
+
+  namespace io{
+
+    //! Marker for the byte order of the binary files
+    const uint32_t byte_order_mark = 0x01020304;
+
+    //! True if a file exists at path
+    inline bool file_exists(const string & path){
+      struct stat st;
+      return !path.empty() && stat(path.c_str(), &st) == 0;
+    }
+
+    //! Creates a directory unless it exists
+    inline void make_directory(const string & path){
+      if(mkdir(path.c_str(), 0755) != 0 && !file_exists(path)){
+        throw runtime_error("Cannot create directory " + path);
+      }
+    }
+
+    //! Rounds n up to a multiple
+    inline uint64_t round_up(uint64_t n, uint64_t multiple){
+      return (n + multiple - 1) / multiple * multiple;
+    }
+
+    /*! Private memory map of a whole file
+     *
+     *  Pages are read from the file when first touched, and writes go to private copies of the
+     *   pages, never to the file.
+     */
+    class MappedFile{
+    public:
+
+      explicit MappedFile(const string & path){
+        this->fd = open(path.c_str(), O_RDONLY);
+        if(this->fd < 0){
+          throw runtime_error("Cannot open " + path);
+        }
+        struct stat st;
+        if(fstat(this->fd, &st) != 0){
+          close(this->fd);
+          throw runtime_error("Cannot read " + path);
+        }
+        this->size = static_cast<size_t>(st.st_size);
+        this->data = nullptr;
+        if(this->size > 0){
+          void * p = mmap(nullptr, this->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, this->fd, 0);
+          if(p == MAP_FAILED){
+            close(this->fd);
+            throw runtime_error("Cannot map " + path);
+          }
+          this->data = static_cast<unsigned char *>(p);
+        }
+      }
+
+      ~MappedFile(){
+        if(this->data){
+          munmap(this->data, this->size);
+        }
+        close(this->fd);
+      }
+
+      unsigned char * data;
+      size_t size;
+
+    private:
+      MappedFile(const MappedFile &);
+      MappedFile & operator=(const MappedFile &);
+      int fd;
+    };
+
+    /*! File that replaces path only when completely written
+     *
+     *  The data is written next to path and renamed over it by commit(), so a program killed while
+     *   writing leaves the previous file intact. Readers that have mapped the previous file keep
+     *   seeing it.
+     */
+    class AtomicFile{
+    public:
+
+      explicit AtomicFile(const string & path){
+        this->path = path;
+        this->tmp_path = path + ".tmp";
+        this->file = fopen(this->tmp_path.c_str(), "wb");
+        this->offset = 0;
+        if(!this->file){
+          throw runtime_error("Cannot create " + this->tmp_path);
+        }
+      }
+
+      ~AtomicFile(){
+        if(this->file){
+          fclose(this->file);
+          remove(this->tmp_path.c_str());
+        }
+      }
+
+      //! Appends n bytes
+      void write(const void * data, size_t n){
+        if(n > 0 && fwrite(data, 1, n, this->file) != n){
+          throw runtime_error("Cannot write " + this->tmp_path);
+        }
+        this->offset += n;
+      }
+
+      //! Appends zero bytes up to the next multiple of alignment
+      void pad(size_t alignment){
+        static const unsigned char zeros[64] = {0};
+        size_t n = round_up(this->offset, alignment) - this->offset;
+        while(n > 0){
+          size_t chunk = n < sizeof(zeros) ? n : sizeof(zeros);
+          this->write(zeros, chunk);
+          n -= chunk;
+        }
+      }
+
+      //! Closes the file and moves it to path
+      void commit(){
+        int error = fclose(this->file);
+        this->file = nullptr;
+        if(error != 0){
+          remove(this->tmp_path.c_str());
+          throw runtime_error("Cannot write " + this->tmp_path);
+        }
+        if(rename(this->tmp_path.c_str(), this->path.c_str()) != 0){
+          remove(this->tmp_path.c_str());
+          throw runtime_error("Cannot replace " + this->path);
+        }
+      }
+
+      //! # of bytes written so far
+      size_t offset;
+
+    private:
+      AtomicFile(const AtomicFile &);
+      AtomicFile & operator=(const AtomicFile &);
+      string path;
+      string tmp_path;
+      FILE * file;
+    };
+
+    /*! 64-bit FNV-1a hash, for keying cached files by their inputs
+     *
+     *  Example usage:
+     *  @code
+     *   Hasher hash;
+     *   hash.add(nsamples);
+     *   hash.add(actions.memptr(), actions.n_elem);
+     *   uint64_t key = hash.value;
+     *  @endcode
+     */
+    struct Hasher{
+
+      Hasher(){
+        this->value = 0xcbf29ce484222325ULL;
+      }
+
+      //! Adds n bytes
+      void add_bytes(const void * data, size_t n){
+        const unsigned char * bytes = static_cast<const unsigned char *>(data);
+        for(size_t i = 0; i < n; ++i){
+          this->value = (this->value ^ bytes[i]) * 0x100000001b3ULL;
+        }
+      }
+
+      //! Adds a value of a trivially copyable type
+      template<typename T>
+      void add(const T & x){
+        this->add_bytes(&x, sizeof(T));
+      }
+
+      //! Adds n values of a trivially copyable type
+      template<typename T>
+      void add(const T * x, size_t n){
+        this->add(static_cast<uint64_t>(n));
+        this->add_bytes(x, n * sizeof(T));
+      }
+
+      //! Adds a string
+      void add(const string & s){
+        this->add(s.data(), s.size());
+      }
+
+      uint64_t value;
+    };
+
+  }
+}
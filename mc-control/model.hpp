@@ -20,11 +20,19 @@
 #pragma once
 
 #include <vector>
-#include <map>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <stdexcept>
+#include <typeinfo>
+#include <type_traits>
+#include <utility>
+#include <limits>
 #include <math.h>
 #include <armadillo>
 #include "mc-control/utils.hpp"
 #include "mc-control/distribution.hpp"
+#include "mc-control/io.hpp"
 
 using namespace std;
 using namespace arma;
@@ -37,6 +45,17 @@ namespace mc{
 
     /*! Abstract base class for the models
      *
+     *  Every call goes through a virtual function and passes the states as heap-allocated vecs.
+     *   New models can derive from StaticModel instead, which DiscretizedModel and the episode
+     *   functions call directly; both kinds work with the same algorithms.
+     *
+     *  Models cached with load_or_discretize also define
+     *
+     *    vec parameters() const;
+     *
+     *   returning every parameter that changes the transitions or the rewards, or vec() if there
+     *   are none, so that a changed model is not given a stale cached discretization. This is
+     *   checked at compile time by discretization_key.
      */
     struct Model{
 
@@ -46,6 +65,18 @@ namespace mc{
       /*! Samples the transition funciton n times*/
       virtual mat sample_transitions(const double & action, size_t n) const = 0;
 
+      /*! Fills the rows of a preallocated (n x nvariables) matrix with samples of the transition
+       *   function, drawing from the given engine.
+       *
+       *  This is what DiscretizedModel calls, for several actions at once on different threads.
+       *   The default calls sample_transitions(action, n) with rng bound to the thread; models
+       *   can override it to draw the random numbers in bulk and write directly into samples.
+       */
+      virtual void fill_transitions(const double & action, mat & samples, Engine & rng) const{
+        mc::rng::ScopedEngine bind(rng);
+        samples = this->sample_transitions(action, samples.n_rows);
+      };
+
       /*! Reward from being in a state, taking action and ending in next_state */
       virtual double reward (const vec & state_value, const double & action_value, const vec & next_state_value) const = 0;
 
@@ -56,33 +87,214 @@ namespace mc{
 
     };
 
+    namespace detail{
+
+      template<typename T>
+      struct always_void{
+        typedef void type;
+      };
+
+      //! True if ModelT declares parameters()
+      template<typename ModelT, typename = void>
+      struct has_parameters : std::false_type{};
+
+      template<typename ModelT>
+      struct has_parameters<ModelT, typename always_void<decltype(std::declval<const ModelT &>().parameters())>::type> : std::true_type{};
+    }
+
+    /*! Base class for models with the state dimension fixed at compile time (CRTP)
+     *
+     *
+     *  The states are vec::fixed<N>, which live on the stack, and the model functions are not virtual,
+     *   so DiscretizedModel and the episode functions call them directly and they can be inlined.
+     *   A state_type is still a vec, so the functions written for Model work on it.
+     *
+     *  The derived model defines
+     *
+     *    void transition(const state_type & state, const double & action, state_type & next_state, Engine & rng) const;
+     *    double reward(const state_type & state, const double & action, const state_type & next_state) const;
+     *    bool constraint(const double & action, const state_type & state) const;
+     *    mat state_lim;
+     *
+     *  and may override fill_transitions like with Model, and define parameters() for
+     *   load_or_discretize like a Model.
+     *
+     *  Example usage:
+     *  @code
+     *   struct GrowthModel : StaticModel<GrowthModel, 1>{
+     *     void transition(const state_type & state, const double & action, state_type & next_state, Engine & rng) const{
+     *       next_state(0) = std::pow(action, 0.8) * std::exp(rng.norm());
+     *     }
+     *     ...
+     *   };
+     *  @endcode
+     *
+     *  @tparam DerivedT the model class itself
+     *  @tparam N        # of state variables
+     */
+    template<typename DerivedT, uword N>
+    struct StaticModel{
+
+      typedef vec::fixed<N> state_type;
+
+      StaticModel(){
+        this->nvariables = N;
+      }
+
+      /*! Fills the rows of a preallocated (n x N) matrix with samples of the transition function,
+       *   drawing from the given engine. The default calls transition n times from the zero state. */
+      void fill_transitions(const double & action, mat & samples, Engine & rng) const{
+        state_type state;
+        state_type next_state;
+        state.zeros();
+        for(size_t i = 0; i < samples.n_rows; ++i){
+          this->derived().transition(state, action, next_state, rng);
+          for(size_t var_i = 0; var_i < N; ++var_i){
+            samples(i,var_i) = next_state(var_i);
+          }
+        }
+      }
+
+      //! The model as its derived type
+      const DerivedT & derived() const{
+        return static_cast<const DerivedT &>(*this);
+      }
+
+      //! # of state variables, N
+      size_t nvariables;
+    };
+
+    namespace detail{
+
+      //! State type of a model: ModelT::state_type for static models, vec otherwise
+      template<typename ModelT, typename = void>
+      struct state_type_of{
+        typedef vec type;
+      };
+
+      template<typename ModelT>
+      struct state_type_of<ModelT, typename always_void<typename ModelT::state_type>::type>{
+        typedef typename ModelT::state_type type;
+      };
+
+      // Fills the factored reward tables if the model splits its reward into immediate_reward and
+      //  continuation_reward (the int overload) and they take at most max_bytes, returns false
+      //  otherwise (the long overload).
+
+      template<typename DiscretizedModelT>
+      auto fill_factored_rewards(DiscretizedModelT & dm, size_t nthreads, size_t max_bytes, int)
+        -> decltype(dm.model.immediate_reward(dm.state_value(0), dm.actions(0)),
+                    dm.model.continuation_reward(dm.actions(0), dm.state_value(0)), bool()){
+        size_t nstates = dm.state_space_size;
+        size_t nactions = dm.nactions;
+        if(2.0 * nstates * nactions * sizeof(typename DiscretizedModelT::real_type) > max_bytes){
+          return false;
+        }
+        dm.rewards.resize(nstates * nactions);
+        dm.next_rewards.resize(nactions * nstates);
+        parallel_for(nstates, [&](size_t begin, size_t end){
+            typename DiscretizedModelT::state_type value;
+            for(size_t state = begin; state < end; ++state){
+              dm.state_value(state, value);
+              for(size_t action = 0; action < nactions; ++action){
+                dm.rewards[state * nactions + action] = dm.model.immediate_reward(value, dm.actions(action));
+                dm.next_rewards[action * nstates + state] = dm.model.continuation_reward(dm.actions(action), value);
+              }
+            }
+          }, nthreads);
+        return true;
+      }
+
+      template<typename DiscretizedModelT>
+      bool fill_factored_rewards(DiscretizedModelT & dm, size_t nthreads, size_t max_bytes, long){
+        return false;
+      }
+    }
+
+    //! Memory budget without a limit, the default for the factored reward tables
+    const size_t unlimited_cache_bytes = numeric_limits<size_t>::max();
+
+    //! How DiscretizedModel::reward gets the rewards
+    enum class RewardCache{
+      none,     //!< calls model.reward every time
+      dense,    //!< looks up R[s,a,s'] from a table of all state, action, next state triples
+      factored  //!< adds R1[s,a] and R2[a,s'] from two tables, for separable rewards
+    };
+
+    //! Version of the discretized model file format
+    const uint32_t discretized_model_version = 2;
+
+    namespace detail{
+
+      //! Header of a discretized model file, followed by the arrays listed in DiscretizedModel::save
+      struct DiscretizedModelHeader{
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint64_t key;
+        uint64_t nvariables;
+        uint64_t nactions;
+        uint64_t seed;
+        unsigned char padding[16];
+      };
+
+      static_assert(sizeof(DiscretizedModelHeader) == 64, "discretized model header has to be 64 bytes");
+
+      const char discretized_model_magic[8] = {'M','C','D','M','O','D','E','L'};
+    }
+
     /*! Creates a discretized version of a given continuous state model
      *
      *
      *  Discretizes the state space and constructs an inverse cumulative distribution
      *   function for inverse transform sampling.
      *
+     *  A model whose reward is immediate_reward(state, action) + continuation_reward(action, next_state)
+     *   gets its rewards precomputed into two small tables, so reward(state, action, next_state) is
+     *   two lookups, unless they do not fit in the factored_cache_bytes given to the constructor.
+     *   The dense table of all state, action and next state triples is opt-in: it is built only
+     *   when it fits in the reward_cache_bytes given to the constructor (see precompute_rewards).
+     *   Otherwise reward calls model.reward.
+     *
+     *  Nothing is stored per state: the value of a state is computed from its index when needed
+     *   (see state_value), so a model with a large grid costs its distributions and reward tables.
+     *
+     *  RealT is the type of the distributions (see BasicDiscreteDistribution) and the reward cache. With
+     *   float the reward tables take half the memory, or twice as many states fit in the same budget.
+     *   The actions, bins and the states passed to the model stay double.
+     *
      */
-    template <typename ModelT>
+    template <typename ModelT, typename RealT = double>
     class DiscretizedModel{
     public:
 
+      //! Type of the state values passed to the model functions
+      typedef typename detail::state_type_of<ModelT>::type state_type;
+
+      //! Type of the distributions and the reward cache
+      typedef RealT real_type;
+
       /*! Constructor
        *
        *  \param model    : continuous state model derived from the abstract model base class
        *  \param actions  : vector of discrete points in continuous action space
        *  \param nbins    : vector, # of bins for each variable
        *  \param nsamples : # of the samples to draw from the model for the discretization
+       *  \param nthreads : # of threads for sampling the transitions and building the distributions (0 = one per hardware thread)
+       *  \param reward_cache_bytes : memory budget of the dense reward table (0 = no dense table, see precompute_rewards)
+       *  \param factored_cache_bytes : memory budget of the factored reward tables (0 = none, see precompute_rewards)
+       *  \param seed     : seed of the transition samples, so the same seed gives the same discretization
        *
        */
-      DiscretizedModel(const ModelT &  model, const vec & actions,  uvec nbins, int nsamples){
+      DiscretizedModel(const ModelT &  model, const vec & actions, const uvec & nbins, int nsamples, size_t nthreads = 0,
+                       size_t reward_cache_bytes = 0, size_t factored_cache_bytes = unlimited_cache_bytes,
+                       uint64_t seed = mc::rng::default_seed){
         size_t nactions = actions.size();
 
         // Create bins for discretization of each state and
         //  calculate middle values for the bins.
         vector<vec> bins;
         vector<vec> bin_values;
-        vec bin_widths(model.nvariables);
         for (auto state : range(model.nvariables)){
           vec state_bins = linspace(model.state_lim(state,0), model.state_lim(state,1), nbins(state)+1);
           vec values(nbins(state));
@@ -91,67 +303,384 @@ namespace mc{
           }
           bins.push_back(state_bins);
           bin_values.push_back(values);
-          bin_widths(state) = state_bins(1) - state_bins(0);
         }
 
         // Discretize the model from a sample
-        // Create distribution for each action
-        vector<DiscreteDistribution> distributions;
-        for(auto action : actions){
-          // Sample the transition function with this action
-          auto sample = model.sample_transitions(action, nsamples);
-          DiscreteDistribution distr(sample, bins, bin_values);
-          distributions.push_back(distr);
-        }
-
-        // Index the state space with all possible combinations of state variables
-        Mat<size_t> state_space = combinations(nbins);
-
-        // Index the state values
-        mat state_values(size(state_space));
-        size_t state_space_size = state_space.n_rows;
-        for(auto state_i : range(state_space_size)){
-          for(auto var_i : range(model.nvariables)){
-            state_values(state_i,var_i) = bin_values[var_i](state_i);
+        // Create distribution for each action. The actions are split between the threads, and
+        //  each thread samples its actions into one reused matrix and bins them. Action i draws
+        //  from stream i of seed, so the distributions do not depend on the number of threads,
+        //  and the calling thread's engine is left as it was, as when the model is loaded.
+        vector<BasicDiscreteDistribution<RealT> > distributions(nactions);
+        parallel_for(nactions, [&](size_t begin, size_t end){
+            mat samples(nsamples, model.nvariables);
+            for(size_t i = begin; i < end; ++i){
+              Engine rng(seed, i);
+              model.fill_transitions(actions(i), samples, rng);
+              distributions[i] = BasicDiscreteDistribution<RealT>(samples, bins, bin_values);
+            }
+          }, nthreads);
+
+        this->init(model, actions, bins, bin_values, distributions);
+        this->seed = seed;
+        this->precompute_rewards(reward_cache_bytes, nthreads, factored_cache_bytes);
+      }
+
+      /*! Loads a discretized model saved with save()
+       *
+       *  The file is memory-mapped and the distributions are rebuilt from the saved histograms in
+       *   O(nbins) per action, giving the same distributions as the model that was saved.
+       *
+       *  \param model : the continuous state model
+       *  \param path  : file written by save()
+       *  \param key   : key that the file has to have (see discretization_key), 0 = any
+       *  \param reward_cache_bytes : memory budget of the dense reward table (0 = no dense table, see precompute_rewards)
+       *  \param factored_cache_bytes : memory budget of the factored reward tables (0 = none, see precompute_rewards)
+       *
+       */
+      DiscretizedModel(const ModelT & model, const string & path, uint64_t key = 0, size_t reward_cache_bytes = 0,
+                       size_t factored_cache_bytes = unlimited_cache_bytes){
+
+        mc::io::MappedFile file(path);
+
+        detail::DiscretizedModelHeader header;
+        if(file.size < sizeof(header)){
+          throw runtime_error("Not a discretized model file: " + path);
+        }
+        std::memcpy(&header, file.data, sizeof(header));
+        if(std::memcmp(header.magic, detail::discretized_model_magic, sizeof(header.magic)) != 0){
+          throw runtime_error("Not a discretized model file: " + path);
+        }
+        if(header.version != discretized_model_version || header.byte_order != mc::io::byte_order_mark){
+          throw runtime_error("Discretized model file of another version or byte order: " + path);
+        }
+        if(key != 0 && header.key != key){
+          throw runtime_error("Discretized model file is for other parameters: " + path);
+        }
+        if(header.nvariables != model.nvariables){
+          throw runtime_error("Discretized model file has a different # of state variables: " + path);
+        }
+
+        // Next n items of the given size in the file
+        size_t offset = sizeof(header);
+        auto read = [&](size_t n, size_t bytes) -> const unsigned char *{
+          if(offset + n * bytes > file.size){
+            throw runtime_error("Truncated discretized model file: " + path);
           }
+          const unsigned char * p = file.data + offset;
+          offset += n * bytes;
+          return p;
+        };
+        auto read_vec = [&](size_t n){
+          vec values(n);
+          std::memcpy(values.memptr(), read(n, sizeof(double)), n * sizeof(double));
+          return values;
+        };
+
+        size_t nvariables = header.nvariables;
+        size_t nactions = header.nactions;
+        vector<uint64_t> nbins(nvariables);
+        std::memcpy(nbins.data(), read(nvariables, sizeof(uint64_t)), nvariables * sizeof(uint64_t));
+
+        vec actions = read_vec(nactions);
+        vector<vec> bins;
+        vector<vec> bin_values;
+        for(auto var_i : range(nvariables)){
+          bins.push_back(read_vec(nbins[var_i] + 1));
+          bin_values.push_back(read_vec(nbins[var_i]));
         }
 
-        // Create reverse index on state space with std::map, so after sampling state variables
-        //   you can find the index of the state variables. 
-        // Use like map[statevec] = state_index
-        // (std::vector can be used as a key in a map, arma::vec cannot)
-        map<vector<size_t>, size_t> state_index_map;
-        for(auto i : range(state_space_size)){
-          vector<size_t> std_state  = conv_to<vector<size_t> >::from(state_space.row(i));
-          state_index_map[std_state] = i;
+        vector<BasicDiscreteDistribution<RealT> > distributions;
+        while(distributions.size() < nactions){
+          vector<vec> hists;
+          for(auto var_i : range(nvariables)){
+            hists.push_back(read_vec(nbins[var_i]));
+          }
+          distributions.push_back(BasicDiscreteDistribution<RealT>(hists, bins, bin_values));
         }
 
-        this->model = model;
-        this->distributions = distributions;
-        this->actions = actions;
-        this->nactions = nactions;
-        this->bins = bins;
-        this->bin_widths = bin_widths;
-        this->bin_values = bin_values;
-        this->state_space = state_space;
-        this->state_values = state_values;
-        this->state_space_size = state_space_size;
-        this->state_index_map = state_index_map;
+        this->init(model, actions, bins, bin_values, distributions);
+        this->seed = header.seed;
+        this->precompute_rewards(reward_cache_bytes, 0, factored_cache_bytes);
+      }
+
+      /*! Saves the discretization (actions, bins, bin values and the histograms of the distributions)
+       *
+       *  The file is the header, the # of bins of each variable (uint64), the actions, the edges and
+       *   values of the bins of each variable, and the histogram of each variable for each action (doubles).
+       *
+       *  \param path : file to write, replaced only when completely written
+       *  \param key  : key to store in the file (see discretization_key)
+       *
+       */
+      void save(const string & path, uint64_t key = 0) const{
+
+        detail::DiscretizedModelHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, detail::discretized_model_magic, sizeof(header.magic));
+        header.version = discretized_model_version;
+        header.byte_order = mc::io::byte_order_mark;
+        header.key = key;
+        header.nvariables = this->bins.size();
+        header.nactions = this->nactions;
+        header.seed = this->seed;
+
+        vector<uint64_t> nbins;
+        for(auto & values : this->bin_values){
+          nbins.push_back(values.size());
+        }
+
+        mc::io::AtomicFile file(path);
+        auto write_vec = [&](const vec & values){
+          file.write(values.memptr(), values.size() * sizeof(double));
+        };
+        file.write(&header, sizeof(header));
+        file.write(nbins.data(), nbins.size() * sizeof(uint64_t));
+        write_vec(this->actions);
+        for(auto var_i : range(this->bins.size())){
+          write_vec(this->bins[var_i]);
+          write_vec(this->bin_values[var_i]);
+        }
+        for(auto & distribution : this->distributions){
+          for(auto & hist : distribution.histograms){
+            write_vec(hist);
+          }
+        }
+        file.commit();
+      }
+
+      //! Index of the state with the given bin indices for each state variable
+      size_t state_index(const vector<size_t> & state) const{
+        return this->indexer.encode(state);
+      }
+
+      /*! Reward from being in a state, taking action and ending in next_state
+       *
+       *  Same as model.reward with the state and action values, from the reward cache when there is one.
+       */
+      double reward(const size_t & state, const size_t & action, const size_t & next_state) const{
+        switch(this->reward_cache){
+        case RewardCache::dense:
+          return this->rewards[(state * this->nactions + action) * this->state_space_size + next_state];
+        case RewardCache::factored:
+          return this->rewards[state * this->nactions + action] + this->next_rewards[action * this->state_space_size + next_state];
+        default:
+          return this->model.reward(this->state_value(state), this->actions(action), this->state_value(next_state));
+        }
+      }
+
+      /*! Precomputes the rewards for reward(state, action, next_state) on nthreads threads
+       *
+       *  Uses the factored tables if the model has immediate_reward and continuation_reward and
+       *   they take at most factored_cache_bytes. They take 2 x nstates x nactions values, the size
+       *   of a Q-table, and nstates x nactions reward calls to fill. Otherwise builds the dense
+       *   table if it takes at most reward_cache_bytes (nstates x nactions x nstates reward calls),
+       *   and else evaluates the rewards on the fly. Give factored_cache_bytes = 0 to keep even a
+       *   separable model's memory independent of the grid, e.g. with the sparse algorithms.
+       *   See clear_rewards for turning the cache off.
+       *
+       *  @retval the kind of cache in use
+       */
+      RewardCache precompute_rewards(size_t reward_cache_bytes = 0, size_t nthreads = 0,
+                                     size_t factored_cache_bytes = unlimited_cache_bytes){
+        size_t nstates = this->state_space_size;
+        size_t nactions = this->nactions;
+
+        this->clear_rewards();
+        if(detail::fill_factored_rewards(*this, nthreads, factored_cache_bytes, 0)){
+          this->reward_cache = RewardCache::factored;
+        }else if(reward_cache_bytes > 0 && static_cast<double>(nstates) * nactions * nstates * sizeof(RealT) <= reward_cache_bytes){
+          this->rewards.resize(nstates * nactions * nstates);
+          // The values of all states, small next to the table
+          vector<state_type> values(nstates);
+          for(size_t state = 0; state < nstates; ++state){
+            this->state_value(state, values[state]);
+          }
+          parallel_for(nstates, [&](size_t begin, size_t end){
+              for(size_t state = begin; state < end; ++state){
+                RealT * r = &this->rewards[state * nactions * nstates];
+                for(size_t action = 0; action < nactions; ++action){
+                  for(size_t next_state = 0; next_state < nstates; ++next_state){
+                    r[action * nstates + next_state] = this->model.reward(values[state], this->actions(action), values[next_state]);
+                  }
+                }
+              }
+            }, nthreads);
+          this->reward_cache = RewardCache::dense;
+        }
+        return this->reward_cache;
+      }
+
+      /*! Samples the next state after actions[j] into out[j] for j < n, as state indices
+       *
+       *  Gives the same states as distributions[actions[j]].sample_index(rng) for j = 0..n-1, with
+       *   the lookups of several samples at once (see BatchSampler). For one action, use
+       *   distributions[action].sample_indices. Does not allocate.
+       */
+      void sample_next_states(const size_t * actions, size_t * out, size_t n, Engine & rng) const{
+        this->sampler.sample_indices(actions, out, n, rng);
+      }
+
+      //! Samples the next state after actions[j] into out[j] for j < n with the engine of this thread
+      void sample_next_states(const size_t * actions, size_t * out, size_t n) const{
+        this->sampler.sample_indices(actions, out, n, mc::rng::local());
+      }
+
+      //! Frees the reward cache, so reward calls model.reward every time
+      void clear_rewards(){
+        this->reward_cache = RewardCache::none;
+        this->rewards.clear();
+        this->rewards.shrink_to_fit();
+        this->next_rewards.clear();
+        this->next_rewards.shrink_to_fit();
+      }
+
+      /*! Value of a state as the model's state type, for passing to the model functions
+       *
+       *  Computed from the bin values of the state variables, so the model keeps nothing per state
+       *   and its memory does not grow with the grid. A state_type of up to 16 variables lives on
+       *   the stack, so this does not allocate.
+       */
+      state_type state_value(const size_t & state) const{
+        state_type value;
+        this->state_value(state, value);
+        return value;
+      }
+
+      //! Writes the value of a state into value, see state_value(state)
+      void state_value(size_t state, state_type & value) const{
+        size_t nvariables = this->bin_values.size();
+        value.set_size(nvariables);
+        for(size_t var_i = 0; var_i < nvariables; ++var_i){
+          size_t stride = this->indexer.strides[var_i];
+          size_t bin = state / stride;
+          state -= bin * stride;
+          value(var_i) = this->bin_values[var_i](bin);
+        }
       }
 
       ModelT model;
-      vector<DiscreteDistribution> distributions;
+      vector<BasicDiscreteDistribution<RealT> > distributions;
       vec actions;
       size_t nactions;
       vector<vec> bins;
       vector<vec> bin_values;
       vec bin_widths;
-      Mat<size_t> state_space;
-      mat state_values;
       size_t state_space_size;
-      map<vector<size_t>, size_t> state_index_map;
+      StateIndexer indexer;
+
+      //! Seed of the transition samples the distributions were built from
+      uint64_t seed;
+
+      //! The distributions of all actions laid out for sample_next_states
+      BasicBatchSampler<RealT> sampler;
+
+      //! Kind of the reward cache
+      RewardCache reward_cache;
+
+      //! Dense rewards R[s,a,s'] at (s*nactions + a)*nstates + s', or factored R1[s,a] at s*nactions + a
+      vector<RealT> rewards;
+
+      //! Factored R2[a,s'] at a*nstates + s'
+      vector<RealT> next_rewards;
+
+    private:
+
+      void init(const ModelT & model, const vec & actions, const vector<vec> & bins, const vector<vec> & bin_values,
+                const vector<BasicDiscreteDistribution<RealT> > & distributions){
+
+        uvec nbins(bin_values.size());
+        vec bin_widths(bin_values.size());
+        for(auto var_i : range(bin_values.size())){
+          nbins(var_i) = bin_values[var_i].size();
+          bin_widths(var_i) = bins[var_i](1) - bins[var_i](0);
+        }
+
+        // The states are all combinations of the bins of the state variables, the last variable
+        //  changing fastest (see combinations). Nothing is stored per state: the indexer maps
+        //  between a state and the bins of its variables.
+        StateIndexer indexer(nbins);
+        size_t state_space_size = indexer.nstates;
+
+        this->model = model;
+        this->distributions = distributions;
+        this->actions = actions;
+        this->nactions = actions.size();
+        this->bins = bins;
+        this->bin_widths = bin_widths;
+        this->bin_values = bin_values;
+        this->state_space_size = state_space_size;
+        this->indexer = indexer;
+        this->sampler = BasicBatchSampler<RealT>(distributions);
+      }
     };
 
+    /*! Key of a discretization: a hash of the model type and parameters (see Model), the state
+     *   limits, the actions, the # of bins, the # of samples and the seed
+     */
+    template <typename ModelT>
+    uint64_t discretization_key(const ModelT & model, const vec & actions, const uvec & nbins, int nsamples,
+                                uint64_t seed = mc::rng::default_seed){
+      static_assert(detail::has_parameters<ModelT>::value,
+                    "A cached model has to define vec parameters() const, returning vec() if it has no parameters");
+      mc::io::Hasher hash;
+      hash.add(discretized_model_version);
+      hash.add(string(typeid(ModelT).name()));
+      vec parameters = model.parameters();
+      hash.add(parameters.memptr(), parameters.n_elem);
+      hash.add(static_cast<uint64_t>(model.nvariables));
+      hash.add(model.state_lim.memptr(), model.state_lim.n_elem);
+      hash.add(actions.memptr(), actions.n_elem);
+      hash.add(nbins.memptr(), nbins.n_elem);
+      hash.add(static_cast<int64_t>(nsamples));
+      hash.add(seed);
+      return hash.value;
+    }
+
+    /*! Loads a discretized model from the cache directory, or discretizes and saves it there
+     *
+     *  The file name is the discretization key (see discretization_key), so changing the model
+     *   parameters, actions, bins, # of samples or seed creates a new file, and repeated runs with the
+     *   same ones skip sampling the transitions. Remove the files to resample.
+     *
+     *  Example usage:
+     *  @code
+     *   DiscretizedModel<OptimalGrowthModel> discrete_model = load_or_discretize("cache", model, actions, nbins, 100000);
+     *  @endcode
+     *
+     *  The file does not depend on RealT, so load_or_discretize<OptimalGrowthModel, float> reads the
+     *   same file as the double version.
+     *
+     *  Neither path draws from the calling thread's engine, so a run after mc::rng::seed gives the
+     *   same results whether the file was there or not.
+     *
+     *  \param cache_dir : directory of the cached models, created if missing
+     *  \param model, actions, nbins, nsamples, nthreads, reward_cache_bytes, factored_cache_bytes, seed : as for the DiscretizedModel constructor
+     */
+    template <typename ModelT, typename RealT = double>
+    DiscretizedModel<ModelT,RealT> load_or_discretize(const string & cache_dir, const ModelT & model, const vec & actions,
+                                                const uvec & nbins, int nsamples, size_t nthreads = 0,
+                                                size_t reward_cache_bytes = 0, size_t factored_cache_bytes = unlimited_cache_bytes,
+                                                uint64_t seed = mc::rng::default_seed){
+      uint64_t key = discretization_key(model, actions, nbins, nsamples, seed);
+      char name[40];
+      snprintf(name, sizeof(name), "discretized-%016llx.mcd", static_cast<unsigned long long>(key));
+      string path = cache_dir + "/" + name;
+
+      if(mc::io::file_exists(path)){
+        try{
+          return DiscretizedModel<ModelT,RealT>(model, path, key, reward_cache_bytes, factored_cache_bytes);
+        }catch(const runtime_error &){
+          // Broken or stale file, discretize again
+        }
+      }
+
+      DiscretizedModel<ModelT,RealT> discrete_model(model, actions, nbins, nsamples, nthreads, reward_cache_bytes,
+                                                    factored_cache_bytes, seed);
+      mc::io::make_directory(cache_dir);
+      discrete_model.save(path, key);
+      return discrete_model;
+    }
+
 
   }
 
@@ -0,0 +1,350 @@
+/* Coarse-to-fine Monte Carlo optimal control
+ *
+ * Copyright (C) 2016  Jarno Kiviaho <jarkki@kapsi.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+#include <tuple>
+#include <algorithm>
+#include <limits>
+#include <armadillo>
+#include "mc-control/utils.hpp"
+#include "mc-control/model.hpp"
+#include "mc-control/qtable.hpp"
+#include "mc-control/stopping.hpp"
+#include "mc-control/observer.hpp"
+#include "mc-control/algorithms.hpp"
+
+using namespace std;
+using namespace arma;
+using namespace mc::utils;
+using namespace mc::models;
+using namespace mc::tables;
+
+namespace mc{
+
+  namespace algorithms{
+
+    namespace detail{
+
+      //! Grid points around x in an ascending grid and the weight of the upper one, clamped at the ends
+      struct Bracket{
+        size_t lo;
+        size_t hi;
+        double t;
+      };
+
+      inline Bracket bracket(const vec & grid, double x){
+        const double * begin = grid.memptr();
+        size_t i = std::upper_bound(begin, begin + grid.n_elem, x) - begin;
+        if(i == 0){
+          return Bracket{0, 0, 0.0};
+        }
+        if(i == grid.n_elem){
+          return Bracket{i - 1, i - 1, 0.0};
+        }
+        return Bracket{i - 1, i, (x - grid(i - 1)) / (grid(i) - grid(i - 1))};
+      }
+    }
+
+    /*! Interpolates the Q-values of a coarse discretization onto a finer one
+     *
+     *  The Q-value of a fine state and action is interpolated multilinearly over the coarse
+     *   bin_values of the state variables and linearly over the coarse actions. Coarse pairs without
+     *   returns (e.g. infeasible actions) are left out and the weights of the others rescaled, so
+     *   that the zeros of unvisited pairs do not pull the values down at the constraints. Pairs with
+     *   no coarse support stay unvisited.
+     *
+     *  The interpolated values count as returns on the fine grid: the coarse counts, interpolated in
+     *   the same way, are shared between the fine pairs covering the same part of the state-action
+     *   space (divided by the ratio of the # of pairs), and scaled by prior_weight. The first returns
+     *   on the fine grid then refine the coarse estimate instead of replacing it. Each supported
+     *   pair counts at least one return.
+     *
+     *  Both discretizations must be of the same model, with ascending actions.
+     *
+     *  @param coarse       coarse discretization
+     *  @param Qc           Q-values and counts on the coarse discretization
+     *  @param fine         fine discretization
+     *  @param prior_weight weight of the coarse returns on the fine grid (0 = one return each)
+     *
+     *  @retval Q-values and counts on the fine discretization
+     */
+    template<typename DiscretizedModelT, typename ValueT, typename CountT>
+    QTable<ValueT,CountT> prolong(const DiscretizedModelT & coarse, const QTable<ValueT,CountT> & Qc, const DiscretizedModelT & fine,
+                                  double prior_weight = 1.0){
+
+      size_t nvariables = fine.bin_values.size();
+      if(coarse.bin_values.size() != nvariables){
+        throw invalid_argument("prolong: the discretizations have a different # of state variables");
+      }
+
+      // Coarse neighbours of each fine bin and each fine action
+      vector<vector<detail::Bracket> > state_brackets(nvariables);
+      for(auto var_i : range(nvariables)){
+        for(auto bin_i : range(fine.bin_values[var_i].size())){
+          state_brackets[var_i].push_back(detail::bracket(coarse.bin_values[var_i], fine.bin_values[var_i](bin_i)));
+        }
+      }
+      vector<detail::Bracket> action_brackets;
+      for(auto action : range(fine.nactions)){
+        action_brackets.push_back(detail::bracket(coarse.actions, fine.actions(action)));
+      }
+
+      // Fine pairs per coarse pair
+      double ratio = static_cast<double>(fine.state_space_size * fine.nactions) / (coarse.state_space_size * coarse.nactions);
+
+      QTable<ValueT,CountT> Q(fine.state_space_size, fine.nactions);
+      vector<size_t> corner_bins(nvariables);
+      vector<size_t> fine_bins(nvariables);
+      vector<double> sums(fine.nactions);
+      vector<double> count_sums(fine.nactions);
+      vector<double> weights(fine.nactions);
+      size_t ncorners = size_t(1) << nvariables;
+
+      for(size_t state = 0; state < fine.state_space_size; ++state){
+        fine.indexer.decode(state, fine_bins.data());
+        std::fill(sums.begin(), sums.end(), 0.0);
+        std::fill(count_sums.begin(), count_sums.end(), 0.0);
+        std::fill(weights.begin(), weights.end(), 0.0);
+
+        // Corners of the coarse cell around the fine state, bit var_i choosing the upper neighbour
+        for(size_t corner = 0; corner < ncorners; ++corner){
+          double w = 1.0;
+          for(size_t var_i = 0; var_i < nvariables; ++var_i){
+            const detail::Bracket & b = state_brackets[var_i][fine_bins[var_i]];
+            bool upper = (corner >> var_i) & 1;
+            corner_bins[var_i] = upper ? b.hi : b.lo;
+            w *= upper ? b.t : 1.0 - b.t;
+          }
+          if(w == 0.0){
+            continue;
+          }
+
+          size_t coarse_state = coarse.state_index(corner_bins);
+          const ValueT * q = Qc.values(coarse_state);
+          const CountT * n = Qc.counts(coarse_state);
+          for(size_t action = 0; action < fine.nactions; ++action){
+            const detail::Bracket & b = action_brackets[action];
+            double wlo = w * (1.0 - b.t);
+            double whi = w * b.t;
+            if(n[b.lo] > 0 && wlo > 0.0){
+              sums[action] += wlo * q[b.lo];
+              count_sums[action] += wlo * n[b.lo];
+              weights[action] += wlo;
+            }
+            if(n[b.hi] > 0 && whi > 0.0){
+              sums[action] += whi * q[b.hi];
+              count_sums[action] += whi * n[b.hi];
+              weights[action] += whi;
+            }
+          }
+        }
+
+        ValueT * q = Q.values(state);
+        CountT * n = Q.counts(state);
+        for(size_t action = 0; action < fine.nactions; ++action){
+          if(weights[action] > 0.0){
+            q[action] = static_cast<ValueT>(sums[action] / weights[action]);
+            double prior = std::min(prior_weight * count_sums[action] / weights[action] / ratio,
+                                    static_cast<double>(numeric_limits<CountT>::max()));
+            n[action] = prior >= 1.0 ? static_cast<CountT>(prior + 0.5) : 1;
+          }
+        }
+      }
+      return Q;
+    }
+
+    /*! Discretizations of a model from coarse to fine, for the multigrid algorithms
+     *
+     *  The last level has the given actions and bins. Each coarser level halves the # of bins of
+     *   every state variable and keeps every other action of the next level (always keeping the last
+     *   action), so the action values of the levels are subsets of each other.
+     *
+     *  @param model    the model
+     *  @param actions  actions of the finest level, ascending
+     *  @param nbins    # of bins of each state variable on the finest level
+     *  @param nlevels  # of levels
+     *  @param nsamples # of samples for estimating the transition densities on each level
+     */
+    template<typename ModelT>
+    vector<DiscretizedModel<ModelT> > make_grid_levels(const ModelT & model, const vec & actions, const uvec & nbins,
+                                                       size_t nlevels, int nsamples){
+      if(nlevels == 0){
+        throw invalid_argument("make_grid_levels: nlevels has to be positive");
+      }
+      vector<DiscretizedModel<ModelT> > levels;
+      for(auto level : range(nlevels)){
+        size_t factor = size_t(1) << (nlevels - 1 - level);
+
+        uvec level_bins(nbins.n_elem);
+        for(auto var_i : range(nbins.n_elem)){
+          level_bins(var_i) = std::max<uword>(1, (nbins(var_i) + factor - 1) / factor);
+        }
+
+        vector<double> level_actions;
+        for(size_t action = 0; action < actions.n_elem; action += factor){
+          level_actions.push_back(actions(action));
+        }
+        if(level_actions.back() != actions(actions.n_elem - 1)){
+          level_actions.push_back(actions(actions.n_elem - 1));
+        }
+
+        levels.push_back(DiscretizedModel<ModelT>(model, vec(level_actions), level_bins, nsamples));
+      }
+      return levels;
+    }
+
+    namespace detail{
+
+      //! Starting values of a level: zeros and a random policy on the first, prolonged from the previous level on the others
+      template<typename DiscretizedModelT, typename ValueT, typename CountT>
+      void start_level(const vector<DiscretizedModelT> & levels, size_t level, QTable<ValueT,CountT> & Q, uvec & pol){
+        const DiscretizedModelT & discrete_model = levels[level];
+        if(level == 0){
+          Q = QTable<ValueT,CountT>(discrete_model.state_space_size, discrete_model.nactions);
+          pol.reset();
+          return;
+        }
+        Q = prolong(levels[level - 1], Q, discrete_model);
+
+        // Greedy policy of the prolonged Q-values
+        FeasibleActions feasible = create_feasible_actions(discrete_model);
+        pol.set_size(discrete_model.state_space_size);
+        for(auto state : range(discrete_model.state_space_size)){
+          pol(state) = argmax_q(Q, state, feasible);
+        }
+      }
+
+      template<typename DiscretizedModelT>
+      void check_levels(const vector<DiscretizedModelT> & levels, const vector<StoppingCriteria> & stops){
+        if(levels.empty() || stops.size() != levels.size()){
+          throw invalid_argument("Multigrid: give one StoppingCriteria for each of one or more levels");
+        }
+      }
+    }
+
+
+    /*! Coarse-to-fine Monte Carlo control with exploring starts.
+     *
+     *
+     *  Runs run_mc_es on each level, from the coarsest to the finest. Each level after the first
+     *   starts from the Q-values of the previous level interpolated onto its grid (see prolong) and
+     *   their greedy policy, instead of zeros and a random policy. Most of the exploration then
+     *   happens on the coarse levels, where an iteration covers a larger share of the state-action
+     *   space, and the fine levels mostly refine. Stopping the levels when the policy is stable
+     *   (StoppingCriteria::policy_stable_checks) lets each level run only as long as it needs to.
+     *
+     *  Example usage:
+     *  @code
+     *   auto levels = make_grid_levels(model, actions, nbins, 3, nsamples);
+     *   StoppingCriteria stop(10000000);
+     *   stop.policy_stable_checks = 5;
+     *   vector<RunReport> reports;
+     *   tie(Q,pol) = run_mc_es_multigrid(levels, episode_es, vector<StoppingCriteria>(3, stop), reports);
+     *  @endcode
+     *
+     *  The Q-values and counts are kept in a QTable<ValueT,CountT> and returned as a Mat<ValueT>, see run_mc_es.
+     *
+     *  @param levels discretizations of the same model, coarsest first (see make_grid_levels)
+     *  @param episode episode function with the same signature as for run_mc_es
+     *  @param stops when to stop on each level
+     *  @param reports filled with the report of each level
+     *  @param observer gets the counters and timers of each level (see NullObserver)
+     *
+     *  @retval two-tuple of Q-value matrix and greedy policy vector on the finest level
+     */
+    template<typename ValueT = double, typename CountT = uint64_t, typename DiscretizedModelT, typename EpisodeFuncT, typename ObserverT>
+    tuple<Mat<ValueT>,uvec> run_mc_es_multigrid(const vector<DiscretizedModelT> & levels,
+                                                EpisodeFuncT episode,
+                                                const vector<StoppingCriteria> & stops,
+                                                vector<RunReport> & reports,
+                                                ObserverT && observer){
+      detail::check_levels(levels, stops);
+      reports.assign(levels.size(), RunReport());
+
+      QTable<ValueT,CountT> Q;
+      uvec pol;
+      for(auto level : range(levels.size())){
+        detail::start_level(levels, level, Q, pol);
+        FirstVisitTracker visits(Q.nstates, Q.nactions);
+        detail::mc_es(levels[level], episode, stops[level], reports[level], CheckpointConfig(), observer, Q, visits, pol);
+      }
+      return make_tuple(Q.to_mat(), pol);
+    }
+
+    //! Coarse-to-fine Monte Carlo control with exploring starts, printing the progress every 10000 iterations
+    template<typename ValueT = double, typename CountT = uint64_t, typename DiscretizedModelT, typename EpisodeFuncT>
+    tuple<Mat<ValueT>,uvec> run_mc_es_multigrid(const vector<DiscretizedModelT> & levels,
+                                                EpisodeFuncT episode,
+                                                const vector<StoppingCriteria> & stops,
+                                                vector<RunReport> & reports){
+      return run_mc_es_multigrid<ValueT,CountT>(levels, episode, stops, reports, ProgressObserver<>());
+    }
+
+
+    /*! Coarse-to-fine Monte Carlo control with epsilon-soft policies.
+     *
+     *
+     *  Runs run_mc_eps_soft on each level, starting each level after the first from the prolonged
+     *   Q-values of the previous one. See run_mc_es_multigrid.
+     *
+     *  @param levels discretizations of the same model, coarsest first (see make_grid_levels)
+     *  @param episode episode function with the same signature as for run_mc_eps_soft
+     *  @param stops when to stop on each level
+     *  @param reports filled with the report of each level
+     *  @param epsilon the probability for taking a soft(random) action (instead of greedy action)
+     *  @param observer gets the counters and timers of each level (see NullObserver)
+     *
+     *  @retval two-tuple of Q-value matrix and greedy policy vector on the finest level
+     */
+    template<typename ValueT = double, typename CountT = uint64_t, typename DiscretizedModelT, typename EpisodeFuncT, typename ObserverT>
+    tuple<Mat<ValueT>,uvec> run_mc_eps_soft_multigrid(const vector<DiscretizedModelT> & levels,
+                                                      EpisodeFuncT episode,
+                                                      const vector<StoppingCriteria> & stops,
+                                                      vector<RunReport> & reports,
+                                                      double epsilon,
+                                                      ObserverT && observer){
+      detail::check_levels(levels, stops);
+      reports.assign(levels.size(), RunReport());
+
+      QTable<ValueT,CountT> Q;
+      uvec pol;
+      for(auto level : range(levels.size())){
+        detail::start_level(levels, level, Q, pol);
+        FirstVisitTracker visits(Q.nstates, Q.nactions);
+        detail::mc_eps_soft(levels[level], episode, stops[level], reports[level], epsilon, CheckpointConfig(), observer, Q, visits, pol);
+      }
+      return make_tuple(Q.to_mat(), pol);
+    }
+
+    //! Coarse-to-fine Monte Carlo control with epsilon-soft policies, printing the progress every 10000 iterations
+    template<typename ValueT = double, typename CountT = uint64_t, typename DiscretizedModelT, typename EpisodeFuncT>
+    tuple<Mat<ValueT>,uvec> run_mc_eps_soft_multigrid(const vector<DiscretizedModelT> & levels,
+                                                      EpisodeFuncT episode,
+                                                      const vector<StoppingCriteria> & stops,
+                                                      vector<RunReport> & reports,
+                                                      double epsilon = 0.1){
+      return run_mc_eps_soft_multigrid<ValueT,CountT>(levels, episode, stops, reports, epsilon, ProgressObserver<>());
+    }
+
+  }
+}
@@ -0,0 +1,262 @@
+/* NumPy .npy and .npz files for Monte Carlo optimal control
+ *
+ * Copyright (C) 2016  Jarno Kiviaho <jarkki@kapsi.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <type_traits>
+#include <armadillo>
+#include "mc-control/io.hpp"
+
+using namespace std;
+using namespace arma;
+
+namespace mc{
+
+  namespace io{
+
+    namespace detail{
+
+      //! NumPy type string of the element type ("f8", "u8", ...), without the byte order
+      template<typename T>
+      string npy_type(){
+        static_assert(is_arithmetic<T>::value, "only arrays of numbers can be saved");
+        char kind = is_floating_point<T>::value ? 'f' : (is_signed<T>::value ? 'i' : 'u');
+        return kind + to_string(sizeof(T));
+      }
+
+      inline string npy_descr(const string & type){
+        const uint16_t one = 1;
+        bool little_endian = *reinterpret_cast<const unsigned char *>(&one) == 1;
+        return (little_endian ? "<" : ">") + type;
+      }
+
+      /*! Header of a version 1.0 .npy file
+       *
+       *  The magic string, the version, the length of the dictionary and the dictionary, padded with
+       *   spaces so that the data starts at a multiple of 64 bytes.
+       */
+      inline string npy_header(const string & type, const vector<size_t> & shape, bool fortran_order){
+        string dict = "{'descr': '" + npy_descr(type) + "', 'fortran_order': " + (fortran_order ? "True" : "False") + ", 'shape': (";
+        for(size_t i = 0; i < shape.size(); ++i){
+          dict += to_string(shape[i]) + (shape.size() == 1 ? "," : (i + 1 < shape.size() ? ", " : ""));
+        }
+        dict += "), }";
+
+        size_t prefix = 10;
+        size_t total = round_up(prefix + dict.size() + 1, 64);
+        dict.append(total - prefix - dict.size() - 1, ' ');
+        dict += '\n';
+
+        string header("\x93NUMPY\x01\x00", 8);
+        header += static_cast<char>(dict.size() & 0xff);
+        header += static_cast<char>((dict.size() >> 8) & 0xff);
+        return header + dict;
+      }
+
+      //! Lookup table of the CRC-32 of each byte
+      struct Crc32Table{
+        Crc32Table(){
+          for(uint32_t i = 0; i < 256; ++i){
+            uint32_t c = i;
+            for(int k = 0; k < 8; ++k){
+              c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            this->values[i] = c;
+          }
+        }
+        uint32_t values[256];
+      };
+
+      //! CRC-32 (as in zip files) of n bytes, continuing from crc
+      inline uint32_t crc32(uint32_t crc, const void * data, size_t n){
+        static const Crc32Table table;
+        const unsigned char * bytes = static_cast<const unsigned char *>(data);
+        crc = ~crc;
+        for(size_t i = 0; i < n; ++i){
+          crc = table.values[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+        }
+        return ~crc;
+      }
+
+      //! Little-endian integer fields of the zip headers
+      inline void put16(string & s, uint16_t x){
+        s += static_cast<char>(x & 0xff);
+        s += static_cast<char>(x >> 8);
+      }
+
+      inline void put32(string & s, uint32_t x){
+        put16(s, static_cast<uint16_t>(x & 0xffff));
+        put16(s, static_cast<uint16_t>(x >> 16));
+      }
+    }
+
+    /*! Writes an array to a .npy file
+     *
+     *  The data is written as it is in memory. Armadillo matrices are column-major, which is
+     *   fortran_order in NumPy, so they are written without reordering.
+     *
+     *  @param path          file to write
+     *  @param data          the elements
+     *  @param shape         size of each dimension
+     *  @param fortran_order true if the first index changes fastest
+     */
+    template<typename T>
+    void save_npy(const string & path, const T * data, const vector<size_t> & shape, bool fortran_order = false){
+      size_t n = 1;
+      for(auto dim : shape){
+        n *= dim;
+      }
+      string header = detail::npy_header(detail::npy_type<T>(), shape, fortran_order);
+      AtomicFile file(path);
+      file.write(header.data(), header.size());
+      file.write(data, n * sizeof(T));
+      file.commit();
+    }
+
+    //! Writes a matrix to a .npy file as a 2-d array
+    template<typename eT>
+    void save_npy(const string & path, const Mat<eT> & m){
+      save_npy(path, m.memptr(), {m.n_rows, m.n_cols}, true);
+    }
+
+    //! Writes a vector to a .npy file as a 1-d array
+    template<typename eT>
+    void save_npy(const string & path, const Col<eT> & v){
+      save_npy(path, v.memptr(), {v.n_elem});
+    }
+
+    /*! Writes arrays into an .npz file, as numpy.savez does
+     *
+     *  The arrays are stored uncompressed, straight from memory. The zip format limits the file to
+     *   4 GB; write larger arrays with save_npy. Nothing is left at path until commit().
+     *
+     *  Example usage:
+     *  @code
+     *   NpzWriter npz("results.npz");
+     *   npz.add("Q", Q);
+     *   npz.add("policy", pol);
+     *   npz.commit();
+     *  @endcode
+     */
+    class NpzWriter{
+    public:
+
+      explicit NpzWriter(const string & path) : file(path){}
+
+      //! Adds an array with the given shape (see save_npy)
+      template<typename T>
+      void add(const string & name, const T * data, const vector<size_t> & shape, bool fortran_order = false){
+        size_t n = 1;
+        for(auto dim : shape){
+          n *= dim;
+        }
+        string header = detail::npy_header(detail::npy_type<T>(), shape, fortran_order);
+        size_t size = header.size() + n * sizeof(T);
+        uint32_t crc = detail::crc32(0, header.data(), header.size());
+        crc = detail::crc32(crc, data, n * sizeof(T));
+
+        if(this->file.offset + size + name.size() + 64 >= 0xffffffffu){
+          throw runtime_error("Array " + name + " does not fit in an .npz file, save it with save_npy");
+        }
+
+        Entry entry = {name + ".npy", crc, static_cast<uint32_t>(size), static_cast<uint32_t>(this->file.offset)};
+        string local;
+        detail::put32(local, 0x04034b50);
+        this->put_fields(local, entry);
+        local += entry.name;
+        this->file.write(local.data(), local.size());
+        this->file.write(header.data(), header.size());
+        this->file.write(data, n * sizeof(T));
+        this->entries.push_back(entry);
+      }
+
+      //! Adds a matrix as a 2-d array
+      template<typename eT>
+      void add(const string & name, const Mat<eT> & m){
+        this->add(name, m.memptr(), {m.n_rows, m.n_cols}, true);
+      }
+
+      //! Adds a vector as a 1-d array
+      template<typename eT>
+      void add(const string & name, const Col<eT> & v){
+        this->add(name, v.memptr(), {v.n_elem});
+      }
+
+      //! Writes the zip directory and moves the file to its path
+      void commit(){
+        uint32_t directory_offset = static_cast<uint32_t>(this->file.offset);
+        string directory;
+        for(auto & entry : this->entries){
+          detail::put32(directory, 0x02014b50);
+          detail::put16(directory, 20);
+          this->put_fields(directory, entry);
+          detail::put16(directory, 0);  // comment length
+          detail::put16(directory, 0);  // disk number
+          detail::put16(directory, 0);  // internal attributes
+          detail::put32(directory, 0);  // external attributes
+          detail::put32(directory, entry.offset);
+          directory += entry.name;
+        }
+        string end;
+        detail::put32(end, 0x06054b50);
+        detail::put16(end, 0);
+        detail::put16(end, 0);
+        detail::put16(end, static_cast<uint16_t>(this->entries.size()));
+        detail::put16(end, static_cast<uint16_t>(this->entries.size()));
+        detail::put32(end, static_cast<uint32_t>(directory.size()));
+        detail::put32(end, directory_offset);
+        detail::put16(end, 0);
+        this->file.write(directory.data(), directory.size());
+        this->file.write(end.data(), end.size());
+        this->file.commit();
+      }
+
+    private:
+
+      struct Entry{
+        string name;
+        uint32_t crc;
+        uint32_t size;
+        uint32_t offset;
+      };
+
+      //! Fields shared by the local and the central headers, from "version needed" to "extra field length"
+      void put_fields(string & s, const Entry & entry) const{
+        detail::put16(s, 20);       // version needed
+        detail::put16(s, 0);        // flags
+        detail::put16(s, 0);        // stored
+        detail::put16(s, 0);        // time
+        detail::put16(s, 0x21);     // date, 1980-01-01
+        detail::put32(s, entry.crc);
+        detail::put32(s, entry.size);
+        detail::put32(s, entry.size);
+        detail::put16(s, static_cast<uint16_t>(entry.name.size()));
+        detail::put16(s, 0);        // extra field length
+      }
+
+      AtomicFile file;
+      vector<Entry> entries;
+    };
+
+  }
+}
@@ -0,0 +1,341 @@
+/* Observers of Monte Carlo optimal control runs
+ *
+ * Copyright (C) 2016  Jarno Kiviaho <jarkki@kapsi.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+#include <type_traits>
+
+using namespace std;
+
+namespace mc{
+
+  namespace algorithms{
+
+    //! Phases of an iteration, timed separately
+    enum class Phase{
+      episode,  //!< generating the episode (the parallel algorithms: a round of the workers)
+      update,   //!< updating the Q-values (the parallel algorithms: merging the worker tables)
+      improve   //!< improving the policy
+    };
+
+    //! Counters and timers of a run, as passed to the observers
+    struct RunMetrics{
+
+      RunMetrics(){
+        this->iterations = 0;
+        this->steps = 0;
+        this->policy_changes = 0;
+        this->visited_pairs = 0;
+        this->state_action_pairs = 0;
+        this->seconds = 0.0;
+        for(auto & s : this->phase_seconds){
+          s = 0.0;
+        }
+      }
+
+      //! # of state, action pairs that have no returns yet
+      size_t unvisited_pairs() const{
+        return this->state_action_pairs - this->visited_pairs;
+      }
+
+      //! Time spent in a phase (zero unless the observer is timed)
+      double phase(Phase phase) const{
+        return this->phase_seconds[static_cast<int>(phase)];
+      }
+
+      //! # of iterations (episodes) run, including those before a resumed checkpoint
+      size_t iterations;
+
+      //! # of steps in the episodes of this run
+      size_t steps;
+
+      //! # of changes of the greedy policy in this run
+      size_t policy_changes;
+
+      //! # of state, action pairs with at least one return
+      size_t visited_pairs;
+
+      //! # of state, action pairs
+      size_t state_action_pairs;
+
+      //! Wall-clock time of this run
+      double seconds;
+
+      //! Time spent in each phase
+      double phase_seconds[3];
+    };
+
+    /*! Observer that is compiled away
+     *
+     *
+     *  The algorithms take an observer type with these members. With enabled false they collect no
+     *   metrics and the calls are optimized out, so the instrumentation costs nothing in the loops.
+     *   The counters of enabled observers cost a few percent. With timed true the algorithms also read
+     *   the clock after each phase of every iteration, which for one-step episodes can cost as much
+     *   as the iteration itself.
+     *
+     *  Example usage:
+     *  @code
+     *   NullObserver quiet;
+     *   tie(Q,pol) = run_mc_es(discrete_model, episode_es, stop, report, CheckpointConfig(), quiet);
+     *  @endcode
+     */
+    struct NullObserver{
+
+      static const bool enabled = false;
+      static const bool timed = false;
+
+      //! True if report should be called after the given # of iterations
+      bool due(const size_t & iterations){
+        return false;
+      }
+
+      //! Called once before the first iteration
+      void start(const RunMetrics & metrics){}
+
+      //! Called when due
+      void report(const RunMetrics & metrics){}
+
+      //! Called once after the last iteration
+      void finish(const RunMetrics & metrics){}
+    };
+
+    /*! Prints the progress of a run every interval iterations
+     *
+     *  The default observer of the algorithms, printing "Iteration N" every 10000 iterations. With
+     *   detailed, the lines also have the counters and, if Timed, the time spent in each phase.
+     *
+     *  @tparam Timed time the phases of the iterations
+     */
+    template<bool Timed = false>
+    class ProgressObserver{
+    public:
+
+      static const bool enabled = true;
+      static const bool timed = Timed;
+
+      /*! Constructor
+       *
+       *  @param interval # of iterations between the lines (0 = no output)
+       *  @param detailed print the counters and timers too
+       *  @param out      stream to print to
+       */
+      explicit ProgressObserver(size_t interval = 10000, bool detailed = false, ostream & out = cout)
+        : out(out){
+        this->interval = interval;
+        this->detailed = detailed;
+        this->next_report = interval;
+      }
+
+      void start(const RunMetrics & metrics){
+        if(this->interval > 0){
+          this->next_report = (metrics.iterations / this->interval + 1) * this->interval;
+        }
+      }
+
+      //! The parallel algorithms advance in rounds, so a report is due at the first check past a multiple of interval
+      bool due(const size_t & iterations){
+        if(this->interval == 0 || iterations < this->next_report){
+          return false;
+        }
+        this->next_report = (iterations / this->interval + 1) * this->interval;
+        return true;
+      }
+
+      void report(const RunMetrics & metrics){
+        this->out << "Iteration " << metrics.iterations;
+        if(this->detailed){
+          this->out << ": " << metrics.steps << " steps, "
+                    << metrics.policy_changes << " policy changes, "
+                    << metrics.unvisited_pairs() << " unvisited state-action pairs, "
+                    << metrics.seconds << " s";
+          if(Timed){
+            this->out << " (episodes " << metrics.phase(Phase::episode)
+                      << " s, updates " << metrics.phase(Phase::update)
+                      << " s, policy " << metrics.phase(Phase::improve) << " s)";
+          }
+        }
+        this->out << endl;
+      }
+
+      void finish(const RunMetrics & metrics){}
+
+      size_t interval;
+      bool detailed;
+
+    private:
+      ostream & out;
+      size_t next_report;
+    };
+
+    /*! Keeps the metrics of a run every interval iterations, and at the end
+     *
+     *  Example usage:
+     *  @code
+     *   MetricsLog<> log(100000);
+     *   tie(Q,pol) = run_mc_es(discrete_model, episode_es, stop, report, CheckpointConfig(), log);
+     *   cout << log.last.phase(Phase::episode) << " s generating episodes" << endl;
+     *  @endcode
+     *
+     *  @tparam Timed time the phases of the iterations
+     */
+    template<bool Timed = true>
+    class MetricsLog{
+    public:
+
+      static const bool enabled = true;
+      static const bool timed = Timed;
+
+      //! @param interval # of iterations between the entries of history (0 = only the final metrics)
+      explicit MetricsLog(size_t interval = 0){
+        this->interval = interval;
+        this->next_report = interval;
+      }
+
+      void start(const RunMetrics & metrics){
+        this->history.clear();
+        if(this->interval > 0){
+          this->next_report = (metrics.iterations / this->interval + 1) * this->interval;
+        }
+      }
+
+      bool due(const size_t & iterations){
+        if(this->interval == 0 || iterations < this->next_report){
+          return false;
+        }
+        this->next_report = (iterations / this->interval + 1) * this->interval;
+        return true;
+      }
+
+      void report(const RunMetrics & metrics){
+        this->history.push_back(metrics);
+      }
+
+      void finish(const RunMetrics & metrics){
+        this->last = metrics;
+      }
+
+      size_t interval;
+
+      //! Metrics every interval iterations
+      vector<RunMetrics> history;
+
+      //! Metrics at the end of the run
+      RunMetrics last;
+
+    private:
+      size_t next_report;
+    };
+
+    namespace detail{
+
+      /*! Collects the metrics for an observer
+       *
+       *  The algorithms call the meter at every event. The specialization for disabled observers
+       *   does nothing.
+       */
+      template<bool Enabled, bool Timed>
+      class Meter{
+      public:
+
+        //! Starts the run after the given # of iterations, counting the visited pairs of Q
+        template<typename QTableT>
+        void start(const QTableT & Q, const size_t & iterations){
+          this->run_start = chrono::steady_clock::now();
+          this->lap_start = this->run_start;
+          this->metrics.iterations = iterations;
+          this->metrics.state_action_pairs = Q.nstates * Q.nactions;
+          this->metrics.visited_pairs = Q.nvisited_pairs();
+        }
+
+        //! Starts timing the first phase of an iteration
+        void begin(){
+          if(Timed){
+            this->lap_start = chrono::steady_clock::now();
+          }
+        }
+
+        //! Ends a phase, the next phase starts now
+        void end(Phase phase){
+          if(Timed){
+            chrono::steady_clock::time_point now = chrono::steady_clock::now();
+            this->metrics.phase_seconds[static_cast<int>(phase)] += chrono::duration<double>(now - this->lap_start).count();
+            this->lap_start = now;
+          }
+        }
+
+        //! Episodes with n steps in total were run
+        void steps(const size_t & n){
+          this->metrics.steps += n;
+        }
+
+        //! A state, action pair got a return, for the first time if first
+        void pair_updated(bool first){
+          if(first){
+            this->metrics.visited_pairs += 1;
+          }
+        }
+
+        void policy_changed(){
+          this->metrics.policy_changes += 1;
+        }
+
+        //! The metrics after the given # of iterations
+        const RunMetrics & snapshot(const size_t & iterations){
+          this->metrics.iterations = iterations;
+          this->metrics.seconds = chrono::duration<double>(chrono::steady_clock::now() - this->run_start).count();
+          return this->metrics;
+        }
+
+      private:
+        RunMetrics metrics;
+        chrono::steady_clock::time_point run_start;
+        chrono::steady_clock::time_point lap_start;
+      };
+
+      template<bool Timed>
+      class Meter<false, Timed>{
+      public:
+        template<typename QTableT>
+        void start(const QTableT & Q, const size_t & iterations){}
+        void begin(){}
+        void end(Phase phase){}
+        void steps(const size_t & n){}
+        void pair_updated(bool first){}
+        void policy_changed(){}
+        const RunMetrics & snapshot(const size_t & iterations){
+          return this->metrics;
+        }
+      private:
+        RunMetrics metrics;
+      };
+
+      //! Meter type for an observer type
+      template<typename ObserverT>
+      struct meter_for{
+        typedef typename std::decay<ObserverT>::type observer_type;
+        typedef Meter<observer_type::enabled, observer_type::timed> type;
+      };
+    }
+
+  }
+}
@@ -0,0 +1,435 @@
+/* Parallel algorithms for Monte Carlo optimal control
+ *
+ * Copyright (C) 2016  Jarno Kiviaho <jarkki@kapsi.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <stdexcept>
+#include <exception>
+#include <vector>
+#include <utility>
+#include <tuple>
+#include <thread>
+#include <algorithm>
+#include <armadillo>
+#include "mc-control/rng.hpp"
+#include "mc-control/utils.hpp"
+#include "mc-control/distribution.hpp"
+#include "mc-control/model.hpp"
+#include "mc-control/episode.hpp"
+#include "mc-control/qtable.hpp"
+#include "mc-control/stopping.hpp"
+#include "mc-control/observer.hpp"
+
+using namespace std;
+using namespace arma;
+using namespace mc::utils;
+using namespace mc::distributions;
+using namespace mc::models;
+using namespace mc::episodes;
+using namespace mc::tables;
+
+namespace mc{
+
+  namespace algorithms{
+
+    /*! Settings for the parallel Monte Carlo control algorithms
+     *
+     *  The episodes are split between nworkers workers, each with its own returns, counters and random
+     *   number stream, and the workers are run on nthreads threads. The results depend on the seed of
+     *   the calling thread's engine and on nworkers, but not on nthreads, so fixing nworkers gives the
+     *   same results on any machine.
+     *
+     *  @param nthreads      # of threads (0 = one per hardware thread)
+     *  @param sync_interval # of episodes each worker runs between merges into the shared Q-values and policy
+     *  @param nworkers      # of workers (0 = one per thread)
+     */
+    struct ParallelConfig{
+
+      ParallelConfig(size_t nthreads = 0, size_t sync_interval = 10000, size_t nworkers = 0){
+        this->nthreads = nthreads;
+        this->sync_interval = sync_interval;
+        this->nworkers = nworkers;
+      }
+
+      //! Number of threads actually used
+      size_t threads() const{
+        return this->nthreads > 0 ? this->nthreads : hardware_threads();
+      }
+
+      //! Number of workers actually used
+      size_t workers() const{
+        return this->nworkers > 0 ? this->nworkers : this->threads();
+      }
+
+      size_t nthreads;
+      size_t sync_interval;
+      size_t nworkers;
+    };
+
+    namespace detail{
+
+      /*! Returns and counts gathered by one worker since the last merge, and the worker's random stream
+       *
+       *  The table holds only the mean returns and counts of this worker's episodes since the last merge.
+       *   The touched list remembers which state, action pairs are non-zero, so the merge and the reset
+       *   cost is proportional to the work done in the round instead of the size of the state-action space.
+       */
+      template<typename ValueT, typename CountT>
+      struct WorkerAccumulator{
+
+        WorkerAccumulator(size_t nstates, size_t nactions, const Engine & rng){
+          this->rng = rng;
+          this->table = QTable<ValueT,CountT>(nstates,nactions);
+          this->visits = FirstVisitTracker(nstates,nactions);
+          this->steps = 0;
+        }
+
+        /*! Adds the first-visit returns of one episode (every-visit if the episode asks for it) */
+        void add_episode(const EpisodeBuffer & episode){
+
+          this->visits.new_episode();
+          this->steps += episode.size();
+          for(auto i : range(episode.size())){
+            size_t s = episode.states[i];
+            size_t a = episode.actions[i];
+
+            // If this is first occurrence of state, action (or every occurrence counts)
+            if(episode.every_visit || this->visits.first_visit(s,a)){
+              if(this->table.count(s,a) == 0){
+                this->touched.push_back(make_pair(s,a));
+              }
+              this->table.update(s,a, episode.returns[i]);
+            }
+          }
+        }
+
+        QTable<ValueT,CountT> table;
+        FirstVisitTracker visits;
+        vector<pair<size_t,size_t> > touched;
+        Engine rng;
+
+        //! # of episode steps since the last merge
+        size_t steps;
+      };
+
+      /*! Runs episodes on worker threads and merges them into Q.
+       *
+       *  Each round every worker runs up to config.sync_interval episodes against a frozen copy of the
+       *   policy. After the round the worker tables are merged into the shared table (combining the
+       *   means by their counts) and improve(state) is called once for every touched state to update
+       *   the policy.
+       *
+       *  The stopping criteria are checked after every round, so with rounds longer than
+       *   stop.check_interval every round is a check.
+       *
+       *  @param generate A function writing one episode into an EpisodeBuffer, given the policy
+       *  @param improve  A function updating pol(state) after a merge, reporting policy changes to the monitor and the meter
+       *  @param meter    Meter of the observer, timing the rounds, merges and policy updates as the phases
+       */
+      template<typename DiscretizedModelT, typename GenerateT, typename ImproveT, typename ValueT, typename CountT, typename MeterT, typename ObserverT>
+      void run_rounds(const DiscretizedModelT & discrete_model,
+                      GenerateT generate,
+                      ImproveT improve,
+                      const StoppingCriteria & stop,
+                      StopMonitor & monitor,
+                      const ParallelConfig & config,
+                      QTable<ValueT,CountT> & Q, uvec & pol,
+                      MeterT & meter,
+                      ObserverT & observer){
+
+        size_t nstates = discrete_model.state_space_size;
+        size_t nactions = discrete_model.nactions;
+        size_t nworkers = config.workers();
+        size_t nthreads = std::min(config.threads(), nworkers);
+
+        if(config.sync_interval == 0){
+          throw invalid_argument("ParallelConfig: sync_interval has to be positive");
+        }
+
+        // Worker w draws from stream w of a seed taken from the calling thread's engine
+        uint64_t run_seed = mc::rng::local()();
+        vector<WorkerAccumulator<ValueT,CountT> > workers;
+        for(auto w : range(nworkers)){
+          workers.push_back(WorkerAccumulator<ValueT,CountT>(nstates, nactions, Engine(run_seed, w)));
+        }
+        vector<exception_ptr> errors(nthreads);
+        Mat<int> state_touched = zeros<Mat<int> >(nstates,1);
+        vector<size_t> touched_states;
+
+        size_t done = 0;
+        meter.start(Q, done);
+        observer.start(meter.snapshot(done));
+        while(!monitor.done(done)){
+          size_t round = std::min(config.sync_interval * nworkers, stop.max_iterations - done);
+          meter.begin();
+
+          // Thread t runs workers t, t + nthreads, t + 2*nthreads, ...
+          const uvec & frozen_pol = pol;
+          vector<thread> threads;
+          for(auto t : range(nthreads)){
+            threads.push_back(thread([&, t](){
+                  try{
+                    EpisodeBuffer episode_buffer;
+                    for(size_t w = t; w < nworkers; w += nthreads){
+                      size_t nepisodes = round / nworkers + (w < round % nworkers ? 1 : 0);
+                      mc::rng::ScopedEngine bind(workers[w].rng);
+                      for(size_t i = 0; i < nepisodes; ++i){
+                        generate(frozen_pol, episode_buffer);
+                        workers[w].add_episode(episode_buffer);
+                      }
+                    }
+                  }catch(...){
+                    errors[t] = current_exception();
+                  }
+                }));
+          }
+          for(auto & t : threads){
+            t.join();
+          }
+          for(auto & error : errors){
+            if(error){
+              rethrow_exception(error);
+            }
+          }
+          meter.end(Phase::episode);
+
+          // Merge the worker tables in a fixed order
+          for(auto & worker : workers){
+            meter.steps(worker.steps);
+            worker.steps = 0;
+            for(auto & sa : worker.touched){
+              size_t s = sa.first;
+              size_t a = sa.second;
+              meter.pair_updated(Q.count(s,a) == 0);
+              monitor.q_changed(Q.merge(s,a, worker.table.q(s,a), worker.table.count(s,a)));
+              worker.table.reset(s,a);
+              if(state_touched(s) == 0){
+                state_touched(s) = 1;
+                touched_states.push_back(s);
+              }
+            }
+            worker.touched.clear();
+          }
+          meter.end(Phase::update);
+
+          // Improve the policy on the states visited during the round
+          for(auto s : touched_states){
+            improve(s);
+            state_touched(s) = 0;
+          }
+          touched_states.clear();
+          meter.end(Phase::improve);
+
+          done += round;
+
+          if(observer.due(done)){
+            observer.report(meter.snapshot(done));
+          }
+        }
+        observer.finish(meter.snapshot(done));
+      }
+    }
+
+
+    /*! Parallel Monte Carlo control with exploring starts.
+     *
+     *
+     *  Same algorithm as run_mc_es, but episodes are run on several threads. Every worker keeps its own
+     *   mean returns and counters, which are merged into the shared Q-values and the greedy policy every
+     *   config.sync_interval episodes per worker. Between the merges the workers follow the policy
+     *   of the previous merge.
+     *
+     *  The episode function is called concurrently and must not modify shared state. Random draws
+     *   through mc::utils (uniform(), norm(), randint()) and DiscreteDistribution::sample() use the
+     *   stream of the worker running the episode.
+     *
+     *  The Q-values and counts are kept in a QTable<ValueT,CountT> and returned as a Mat<ValueT>, see run_mc_es.
+     *
+     *  @param discrete_model discretized model
+     *  @param episode episode function with the same signature as for run_mc_es
+     *  @param stop when to stop (see StoppingCriteria). Iterations are episodes summed over all threads,
+     *          and the criteria are checked after each merge.
+     *  @param report filled with the # of iterations run and the reason for stopping
+     *  @param config # of threads and the merge interval
+     *  @param observer gets the counters and timers of the run after each merge (see NullObserver)
+     *
+     *  @retval two-tuple of Q-value matrix and greedy policy vector
+     */
+    template<typename ValueT = double, typename CountT = uint64_t, typename DiscretizedModelT, typename EpisodeFuncT, typename ObserverT>
+    tuple<Mat<ValueT>,uvec> run_mc_es_parallel(const DiscretizedModelT & discrete_model,
+                                               EpisodeFuncT episode,
+                                               const StoppingCriteria & stop,
+                                               RunReport & report,
+                                               const ParallelConfig & config,
+                                               ObserverT && observer){
+
+      size_t nstates = discrete_model.state_space_size;
+      size_t nactions = discrete_model.nactions;
+
+      // Init the Q-values and counters
+      QTable<ValueT,CountT> Q(nstates,nactions);
+
+      // Init the feasible actions of each state
+      FeasibleActions feasible = create_feasible_actions(discrete_model);
+
+      // Init random policy
+      uvec pol = create_random_policy(feasible);
+
+      auto generate = [&](const uvec & frozen_pol, EpisodeBuffer & episode_buffer){
+        // Draw random starting state and action
+        size_t state = randint(nstates);
+        size_t action = feasible.random_action(state);
+        run_episode(episode, discrete_model, state, action, frozen_pol, episode_buffer);
+      };
+
+      detail::StopMonitor monitor(stop, report);
+      typename detail::meter_for<ObserverT>::type meter;
+
+      // Update policy to greedy policy
+      auto improve = [&](size_t state){
+        size_t greedy = argmax_q(Q, state, feasible);
+        if(pol(state) != greedy){
+          pol(state) = greedy;
+          monitor.policy_changed();
+          meter.policy_changed();
+        }
+      };
+
+      detail::run_rounds(discrete_model, generate, improve, stop, monitor, config, Q, pol, meter, observer);
+
+      return make_tuple(Q.to_mat(), pol);
+    }
+
+    //! Parallel Monte Carlo control with exploring starts, printing the progress every 10000 iterations
+    template<typename ValueT = double, typename CountT = uint64_t, typename DiscretizedModelT, typename EpisodeFuncT>
+    tuple<Mat<ValueT>,uvec> run_mc_es_parallel(const DiscretizedModelT & discrete_model,
+                                               EpisodeFuncT episode,
+                                               const StoppingCriteria & stop,
+                                               RunReport & report,
+                                               const ParallelConfig & config = ParallelConfig()){
+      return run_mc_es_parallel<ValueT,CountT>(discrete_model, episode, stop, report, config, ProgressObserver<>());
+    }
+
+    //! Parallel Monte Carlo control with exploring starts, running niterations iterations
+    template<typename ValueT = double, typename CountT = uint64_t, typename DiscretizedModelT, typename EpisodeFuncT>
+    tuple<Mat<ValueT>,uvec> run_mc_es_parallel(const DiscretizedModelT & discrete_model,
+                                               EpisodeFuncT episode,
+                                               size_t niterations = 100000,
+                                               const ParallelConfig & config = ParallelConfig()){
+      RunReport report;
+      return run_mc_es_parallel<ValueT,CountT>(discrete_model, episode, StoppingCriteria(niterations), report, config);
+    }
+
+
+    /*! Parallel Monte Carlo control with epsilon-soft policies.
+     *
+     *
+     *  Same algorithm as run_mc_eps_soft, with episodes run on several threads. See run_mc_es_parallel
+     *   for how the worker results are merged.
+     *
+     *  @param discrete_model discretized model
+     *  @param episode episode function with the same signature as for run_mc_eps_soft
+     *  @param stop when to stop (see run_mc_es_parallel). The policy criterion looks at the greedy part of the policy only.
+     *  @param report filled with the # of iterations run and the reason for stopping
+     *  @param epsilon the probability for taking a soft(random) action (instead of greedy action)
+     *  @param config # of threads and the merge interval
+     *  @param observer gets the counters and timers of the run after each merge (see NullObserver)
+     *
+     *  @retval two-tuple of Q-value matrix and greedy policy vector
+     */
+    template<typename ValueT = double, typename CountT = uint64_t, typename DiscretizedModelT, typename EpisodeFuncT, typename ObserverT>
+    tuple<Mat<ValueT>,uvec> run_mc_eps_soft_parallel(const DiscretizedModelT & discrete_model,
+                                                     EpisodeFuncT episode,
+                                                     const StoppingCriteria & stop,
+                                                     RunReport & report,
+                                                     double epsilon,
+                                                     const ParallelConfig & config,
+                                                     ObserverT && observer){
+
+      size_t nstates = discrete_model.state_space_size;
+      size_t nactions = discrete_model.nactions;
+
+      // Init the Q-values and counters
+      QTable<ValueT,CountT> Q(nstates,nactions);
+
+      // Init the feasible actions of each state
+      FeasibleActions feasible = create_feasible_actions(discrete_model);
+
+      // Init random policy
+      uvec pol = create_random_policy(feasible);
+
+      auto generate = [&](const uvec & frozen_pol, EpisodeBuffer & episode_buffer){
+        run_episode(episode, discrete_model, frozen_pol, episode_buffer);
+      };
+
+      // Greedy actions, for noticing when the policy has settled
+      uvec greedy_pol = pol;
+
+      detail::StopMonitor monitor(stop, report);
+      typename detail::meter_for<ObserverT>::type meter;
+
+      // Update policy with epsilon-greedy selection
+      auto improve = [&](size_t state){
+        size_t greedy = argmax_q(Q, state, feasible);
+        if(greedy_pol(state) != greedy){
+          greedy_pol(state) = greedy;
+          monitor.policy_changed();
+          meter.policy_changed();
+        }
+        if(uniform() < epsilon){
+          pol(state) = feasible.random_action(state);
+        }else{
+          pol(state) = greedy;
+        }
+      };
+
+      detail::run_rounds(discrete_model, generate, improve, stop, monitor, config, Q, pol, meter, observer);
+
+      // Calculate greedy policy
+      for(auto state : range(nstates)){
+        pol(state) = argmax_q(Q, state, feasible);
+      }
+
+      return make_tuple(Q.to_mat(), pol);
+    }
+
+    //! Parallel Monte Carlo control with epsilon-soft policies, printing the progress every 10000 iterations
+    template<typename ValueT = double, typename CountT = uint64_t, typename DiscretizedModelT, typename EpisodeFuncT>
+    tuple<Mat<ValueT>,uvec> run_mc_eps_soft_parallel(const DiscretizedModelT & discrete_model,
+                                                     EpisodeFuncT episode,
+                                                     const StoppingCriteria & stop,
+                                                     RunReport & report,
+                                                     double epsilon = 0.1,
+                                                     const ParallelConfig & config = ParallelConfig()){
+      return run_mc_eps_soft_parallel<ValueT,CountT>(discrete_model, episode, stop, report, epsilon, config, ProgressObserver<>());
+    }
+
+    //! Parallel Monte Carlo control with epsilon-soft policies, running niterations iterations
+    template<typename ValueT = double, typename CountT = uint64_t, typename DiscretizedModelT, typename EpisodeFuncT>
+    tuple<Mat<ValueT>,uvec> run_mc_eps_soft_parallel(const DiscretizedModelT & discrete_model,
+                                                     EpisodeFuncT episode,
+                                                     size_t niterations = 100000,
+                                                     double epsilon = 0.1,
+                                                     const ParallelConfig & config = ParallelConfig()){
+      RunReport report;
+      return run_mc_eps_soft_parallel<ValueT,CountT>(discrete_model, episode, StoppingCriteria(niterations), report, epsilon, config);
+    }
+
+  }
+}
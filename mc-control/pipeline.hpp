@@ -0,0 +1,569 @@
+/* Pipelined algorithms for Monte Carlo optimal control
+ *
+ * Copyright (C) 2016  Jarno Kiviaho <jarkki@kapsi.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <exception>
+#include <vector>
+#include <tuple>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <armadillo>
+#include "mc-control/rng.hpp"
+#include "mc-control/utils.hpp"
+#include "mc-control/model.hpp"
+#include "mc-control/episode.hpp"
+#include "mc-control/qtable.hpp"
+#include "mc-control/stopping.hpp"
+#include "mc-control/observer.hpp"
+
+using namespace std;
+using namespace arma;
+using namespace mc::utils;
+using namespace mc::models;
+using namespace mc::episodes;
+using namespace mc::tables;
+
+namespace mc{
+
+  namespace algorithms{
+
+    /*! Settings for the pipelined Monte Carlo control algorithms
+     *
+     *  @param nproducers      # of threads generating episodes (0 = one less than the hardware threads, at least one)
+     *  @param batch           # of episodes a producer hands over at a time
+     *  @param queue_capacity  # of batches a producer can have waiting for the learner
+     *  @param publish_interval # of learned episodes between the policy snapshots sent to the producers
+     */
+    struct PipelineConfig{
+
+      PipelineConfig(size_t nproducers = 0, size_t batch = 256, size_t queue_capacity = 16, size_t publish_interval = 10000){
+        this->nproducers = nproducers;
+        this->batch = batch;
+        this->queue_capacity = queue_capacity;
+        this->publish_interval = publish_interval;
+      }
+
+      //! Number of producer threads actually used
+      size_t producers() const{
+        if(this->nproducers > 0){
+          return this->nproducers;
+        }
+        size_t n = hardware_threads();
+        return n > 1 ? n - 1 : 1;
+      }
+
+      size_t nproducers;
+      size_t batch;
+      size_t queue_capacity;
+      size_t publish_interval;
+    };
+
+    namespace detail{
+
+      /*! Episodes of a producer, stored back to back
+       *
+       *  Episode e has the steps [ends[e-1], ends[e]). The vectors keep their capacity when the batch
+       *   is cleared and reused, so after the first few batches nothing is allocated.
+       */
+      struct EpisodeBatch{
+
+        void clear(){
+          this->states.clear();
+          this->actions.clear();
+          this->returns.clear();
+          this->ends.clear();
+          this->every_visit.clear();
+        }
+
+        void add(const EpisodeBuffer & episode){
+          this->states.insert(this->states.end(), episode.states.begin(), episode.states.end());
+          this->actions.insert(this->actions.end(), episode.actions.begin(), episode.actions.end());
+          this->returns.insert(this->returns.end(), episode.returns.begin(), episode.returns.end());
+          this->ends.push_back(static_cast<uint32_t>(this->states.size()));
+          this->every_visit.push_back(episode.every_visit);
+        }
+
+        size_t nepisodes() const{
+          return this->ends.size();
+        }
+
+        vector<size_t> states;
+        vector<uint32_t> actions;
+        vector<double> returns;
+        vector<uint32_t> ends;
+        vector<unsigned char> every_visit;
+      };
+
+      /*! Bounded lock-free queue between one producer thread and one consumer thread
+       *
+       *  The head and the tail are on cache lines of their own, so the two threads only share a line
+       *   when one of them looks at the other's position.
+       */
+      template<typename T>
+      class SpscRing{
+      public:
+
+        explicit SpscRing(size_t capacity) : slots(capacity + 1){
+          this->head.store(0, memory_order_relaxed);
+          this->tail.store(0, memory_order_relaxed);
+        }
+
+        //! Adds a value, false if the queue is full
+        bool push(const T & value){
+          size_t t = this->tail.load(memory_order_relaxed);
+          size_t next = t + 1 == this->slots.size() ? 0 : t + 1;
+          if(next == this->head.load(memory_order_acquire)){
+            return false;
+          }
+          this->slots[t] = value;
+          this->tail.store(next, memory_order_release);
+          return true;
+        }
+
+        //! Takes the oldest value, false if the queue is empty
+        bool pop(T & value){
+          size_t h = this->head.load(memory_order_relaxed);
+          if(h == this->tail.load(memory_order_acquire)){
+            return false;
+          }
+          value = this->slots[h];
+          this->head.store(h + 1 == this->slots.size() ? 0 : h + 1, memory_order_release);
+          return true;
+        }
+
+      private:
+        vector<T> slots;
+        char padding0[64];
+        atomic<size_t> head;
+        char padding1[64 - sizeof(atomic<size_t>)];
+        atomic<size_t> tail;
+        char padding2[64 - sizeof(atomic<size_t>)];
+      };
+
+      /*! A producer thread's batches and queues
+       *
+       *  The batches circulate: the producer takes an empty one from free_batches, fills it and puts
+       *   it into full_batches, and the learner returns it to free_batches once it is learned.
+       */
+      struct Producer{
+
+        Producer(size_t capacity, const Engine & rng)
+          : batches(capacity), full_batches(capacity), free_batches(capacity){
+          this->rng = rng;
+          for(auto & batch : this->batches){
+            this->free_batches.push(&batch);
+          }
+          this->finished.store(false, memory_order_relaxed);
+        }
+
+        vector<EpisodeBatch> batches;
+        SpscRing<EpisodeBatch *> full_batches;
+        SpscRing<EpisodeBatch *> free_batches;
+        Engine rng;
+        exception_ptr error;
+
+        //! Set when the producer has pushed its last batch
+        atomic<bool> finished;
+      };
+
+      //! Stops and joins the producer threads, also when the learner throws
+      class ThreadJoiner{
+      public:
+
+        ThreadJoiner(vector<thread> & threads, atomic<bool> & stopped) : threads(threads), stopped(stopped){}
+
+        ~ThreadJoiner(){
+          this->join();
+        }
+
+        void join(){
+          this->stopped.store(true, memory_order_relaxed);
+          for(auto & t : this->threads){
+            if(t.joinable()){
+              t.join();
+            }
+          }
+        }
+
+      private:
+        vector<thread> & threads;
+        atomic<bool> & stopped;
+      };
+
+      /*! Generates episodes on producer threads and learns them on the calling thread
+       *
+       *  The producers claim batches of config.batch episodes until stop.max_iterations are claimed
+       *   and generate them with the latest published policy. The calling thread is the only one that
+       *   touches Q and pol: it takes the batches from the producers in turn, applies the first-visit
+       *   updates (every-visit if the episode asks for it), calls improve(state) for the states of each
+       *   episode, and every config.publish_interval episodes publishes a copy of pol to the producers.
+       *   The stopping criteria are checked before every episode, as in run_mc_es.
+       *
+       *  @param generate A function writing one episode into an EpisodeBuffer, given the policy
+       *  @param improve  A function updating pol(state) after an update, reporting policy changes to the monitor and the meter
+       *  @param meter    Meter of the observer. The episode phase is the time spent waiting for the producers.
+       */
+      template<typename GenerateT, typename ImproveT, typename ValueT, typename CountT, typename MeterT, typename ObserverT>
+      void run_pipeline(GenerateT generate,
+                        ImproveT improve,
+                        const StoppingCriteria & stop,
+                        StopMonitor & monitor,
+                        const PipelineConfig & config,
+                        QTable<ValueT,CountT> & Q, uvec & pol,
+                        MeterT & meter,
+                        ObserverT & observer){
+
+        if(config.batch == 0 || config.queue_capacity == 0 || config.publish_interval == 0){
+          throw invalid_argument("PipelineConfig: batch, queue_capacity and publish_interval have to be positive");
+        }
+        size_t nproducers = config.producers();
+
+        // Producer p draws from stream p of a seed taken from the calling thread's engine
+        uint64_t run_seed = mc::rng::local()();
+        vector<unique_ptr<Producer> > producers;
+        for(auto p : range(nproducers)){
+          producers.push_back(unique_ptr<Producer>(new Producer(config.queue_capacity, Engine(run_seed, p))));
+        }
+
+        // Policy snapshots, and their number so that the producers only reload a new one
+        shared_ptr<const uvec> snapshot = make_shared<const uvec>(pol);
+        atomic<size_t> version(0);
+
+        atomic<size_t> claimed(0);
+        atomic<bool> stopped(false);
+
+        vector<thread> threads;
+        ThreadJoiner joiner(threads, stopped);
+        for(auto p : range(nproducers)){
+          threads.push_back(thread([&, p](){
+                Producer & producer = *producers[p];
+                try{
+                  mc::rng::ScopedEngine bind(producer.rng);
+                  EpisodeBuffer episode_buffer;
+                  size_t seen = version.load(memory_order_acquire);
+                  shared_ptr<const uvec> policy = atomic_load(&snapshot);
+
+                  while(!stopped.load(memory_order_relaxed)){
+                    size_t first = claimed.fetch_add(config.batch);
+                    if(first >= stop.max_iterations){
+                      break;
+                    }
+                    size_t nepisodes = std::min(config.batch, stop.max_iterations - first);
+
+                    EpisodeBatch * batch;
+                    while(!producer.free_batches.pop(batch)){
+                      if(stopped.load(memory_order_relaxed)){
+                        return;
+                      }
+                      std::this_thread::yield();
+                    }
+
+                    if(version.load(memory_order_acquire) != seen){
+                      seen = version.load(memory_order_acquire);
+                      policy = atomic_load(&snapshot);
+                    }
+
+                    batch->clear();
+                    for(size_t i = 0; i < nepisodes; ++i){
+                      generate(*policy, episode_buffer);
+                      batch->add(episode_buffer);
+                    }
+
+                    while(!producer.full_batches.push(batch)){
+                      if(stopped.load(memory_order_relaxed)){
+                        return;
+                      }
+                      std::this_thread::yield();
+                    }
+                  }
+                }catch(...){
+                  producer.error = current_exception();
+                }
+                producer.finished.store(true, memory_order_release);
+              }));
+        }
+
+        // First occurrences of state, action pairs in the episode
+        FirstVisitTracker visits(Q.nstates, Q.nactions);
+
+        size_t iteration = 0;
+        size_t next_publish = config.publish_interval;
+        size_t next_producer = 0;
+        bool done = monitor.done(iteration);
+
+        meter.start(Q, iteration);
+        observer.start(meter.snapshot(iteration));
+
+        while(!done){
+          meter.begin();
+
+          // Next full batch, taking the producers in turn
+          EpisodeBatch * batch = nullptr;
+          Producer * from = nullptr;
+          while(batch == nullptr){
+            size_t nfinished = 0;
+            for(size_t k = 0; k < nproducers && batch == nullptr; ++k){
+              Producer & producer = *producers[next_producer];
+              next_producer = next_producer + 1 == nproducers ? 0 : next_producer + 1;
+              // Read before popping, so a finished producer with an empty queue has nothing more to give
+              bool finished = producer.finished.load(memory_order_acquire);
+              if(producer.full_batches.pop(batch)){
+                from = &producer;
+              }else if(finished){
+                if(producer.error){
+                  rethrow_exception(producer.error);
+                }
+                nfinished += 1;
+              }
+            }
+            if(batch == nullptr){
+              if(nfinished == nproducers){
+                throw logic_error("Pipeline: the producers finished before the run");
+              }
+              std::this_thread::yield();
+            }
+          }
+          meter.end(Phase::episode);
+
+          size_t start = 0;
+          for(size_t e = 0; e < batch->nepisodes() && !done; ++e){
+            size_t end = batch->ends[e];
+            bool every_visit = batch->every_visit[e] != 0;
+
+            // Forget the occurrences of the previous episode
+            visits.new_episode();
+            meter.steps(end - start);
+
+            // For each state, action pair in episode
+            for(size_t i = start; i < end; ++i){
+              size_t s = batch->states[i];
+              size_t a = batch->actions[i];
+
+              // If this is first occurrence of state, action (or every occurrence counts)
+              if(every_visit || visits.first_visit(s,a)){
+
+                // Increase counter and update Q-value (mean of the returns)
+                monitor.q_changed(Q.update(s,a, batch->returns[i]));
+                meter.pair_updated(Q.count(s,a) == 1);
+              }
+            }
+            meter.end(Phase::update);
+
+            for(size_t i = start; i < end; ++i){
+              improve(batch->states[i]);
+            }
+            meter.end(Phase::improve);
+            start = end;
+
+            ++iteration;
+
+            if(iteration >= next_publish){
+              next_publish = iteration + config.publish_interval;
+              atomic_store(&snapshot, make_shared<const uvec>(pol));
+              version.fetch_add(1, memory_order_release);
+            }
+
+            if(observer.due(iteration)){
+              observer.report(meter.snapshot(iteration));
+            }
+
+            done = monitor.done(iteration);
+          }
+
+          // The producer can reuse the batch; a full free queue cannot happen, it holds all the batches
+          from->free_batches.push(batch);
+        }
+
+        joiner.join();
+        observer.finish(meter.snapshot(iteration));
+      }
+    }
+
+
+    /*! Pipelined Monte Carlo control with exploring starts.
+     *
+     *
+     *  Same algorithm as run_mc_es, with the episodes generated on producer threads and learned on the
+     *   calling thread. The producers hand batches of episodes to the learner through lock-free
+     *   queues, and the learner, the only thread touching the Q-values and the policy, sends them
+     *   a copy of the policy every config.publish_interval episodes. This keeps all cores busy when
+     *   the model's transition and reward are expensive, while the learner's tables stay in one
+     *   core's cache.
+     *
+     *  The producers follow a policy that is up to publish_interval episodes plus the queued
+     *   batches old, so the run takes somewhat more iterations than run_mc_es to settle. The results
+     *   are not reproducible, since the learner takes the batches in the order they are ready.
+     *
+     *  The Q-values and counts are kept in a QTable<ValueT,CountT> and returned as a Mat<ValueT>, see run_mc_es.
+     *
+     *  @param discrete_model discretized model
+     *  @param episode episode function with the same signature as for run_mc_es, called concurrently
+     *  @param stop when to stop (see StoppingCriteria)
+     *  @param report filled with the # of iterations run and the reason for stopping
+     *  @param config # of producers, batch size, queue length and policy publishing interval
+     *  @param observer gets the counters and timers of the learner (see NullObserver)
+     *
+     *  @retval two-tuple of Q-value matrix and greedy policy vector
+     */
+    template<typename ValueT = double, typename CountT = uint64_t, typename DiscretizedModelT, typename EpisodeFuncT, typename ObserverT>
+    tuple<Mat<ValueT>,uvec> run_mc_es_pipeline(const DiscretizedModelT & discrete_model,
+                                               EpisodeFuncT episode,
+                                               const StoppingCriteria & stop,
+                                               RunReport & report,
+                                               const PipelineConfig & config,
+                                               ObserverT && observer){
+
+      size_t nstates = discrete_model.state_space_size;
+      size_t nactions = discrete_model.nactions;
+
+      // Init the Q-values and counters
+      QTable<ValueT,CountT> Q(nstates,nactions);
+
+      // Init the feasible actions of each state
+      FeasibleActions feasible = create_feasible_actions(discrete_model);
+
+      // Init random policy
+      uvec pol = create_random_policy(feasible);
+
+      auto generate = [&](const uvec & snapshot, EpisodeBuffer & episode_buffer){
+        // Draw random starting state and action
+        size_t state = randint(nstates);
+        size_t action = feasible.random_action(state);
+        run_episode(episode, discrete_model, state, action, snapshot, episode_buffer);
+      };
+
+      detail::StopMonitor monitor(stop, report);
+      typename detail::meter_for<ObserverT>::type meter;
+
+      // Update policy to greedy policy
+      auto improve = [&](size_t state){
+        size_t greedy = argmax_q(Q, state, feasible);
+        if(pol(state) != greedy){
+          pol(state) = greedy;
+          monitor.policy_changed();
+          meter.policy_changed();
+        }
+      };
+
+      detail::run_pipeline(generate, improve, stop, monitor, config, Q, pol, meter, observer);
+
+      return make_tuple(Q.to_mat(), pol);
+    }
+
+    //! Pipelined Monte Carlo control with exploring starts, printing the progress every 10000 iterations
+    template<typename ValueT = double, typename CountT = uint64_t, typename DiscretizedModelT, typename EpisodeFuncT>
+    tuple<Mat<ValueT>,uvec> run_mc_es_pipeline(const DiscretizedModelT & discrete_model,
+                                               EpisodeFuncT episode,
+                                               const StoppingCriteria & stop,
+                                               RunReport & report,
+                                               const PipelineConfig & config = PipelineConfig()){
+      return run_mc_es_pipeline<ValueT,CountT>(discrete_model, episode, stop, report, config, ProgressObserver<>());
+    }
+
+
+    /*! Pipelined Monte Carlo control with epsilon-soft policies.
+     *
+     *
+     *  Same algorithm as run_mc_eps_soft, with the episodes generated on producer threads. See
+     *   run_mc_es_pipeline. The producers get the epsilon-soft policy.
+     *
+     *  @param discrete_model discretized model
+     *  @param episode episode function with the same signature as for run_mc_eps_soft, called concurrently
+     *  @param stop when to stop (see StoppingCriteria). The policy criterion looks at the greedy part of the policy only.
+     *  @param report filled with the # of iterations run and the reason for stopping
+     *  @param epsilon the probability for taking a soft(random) action (instead of greedy action)
+     *  @param config # of producers, batch size, queue length and policy publishing interval
+     *  @param observer gets the counters and timers of the learner (see NullObserver)
+     *
+     *  @retval two-tuple of Q-value matrix and greedy policy vector
+     */
+    template<typename ValueT = double, typename CountT = uint64_t, typename DiscretizedModelT, typename EpisodeFuncT, typename ObserverT>
+    tuple<Mat<ValueT>,uvec> run_mc_eps_soft_pipeline(const DiscretizedModelT & discrete_model,
+                                                     EpisodeFuncT episode,
+                                                     const StoppingCriteria & stop,
+                                                     RunReport & report,
+                                                     double epsilon,
+                                                     const PipelineConfig & config,
+                                                     ObserverT && observer){
+
+      size_t nstates = discrete_model.state_space_size;
+      size_t nactions = discrete_model.nactions;
+
+      // Init the Q-values and counters
+      QTable<ValueT,CountT> Q(nstates,nactions);
+
+      // Init the feasible actions of each state
+      FeasibleActions feasible = create_feasible_actions(discrete_model);
+
+      // Init random policy
+      uvec pol = create_random_policy(feasible);
+
+      auto generate = [&](const uvec & snapshot, EpisodeBuffer & episode_buffer){
+        run_episode(episode, discrete_model, snapshot, episode_buffer);
+      };
+
+      // Greedy actions, for noticing when the policy has settled
+      uvec greedy_pol = pol;
+
+      detail::StopMonitor monitor(stop, report);
+      typename detail::meter_for<ObserverT>::type meter;
+
+      // Update policy with epsilon-greedy selection
+      auto improve = [&](size_t state){
+        size_t greedy = argmax_q(Q, state, feasible);
+        if(greedy_pol(state) != greedy){
+          greedy_pol(state) = greedy;
+          monitor.policy_changed();
+          meter.policy_changed();
+        }
+        if(uniform() < epsilon){
+          pol(state) = feasible.random_action(state);
+        }else{
+          pol(state) = greedy;
+        }
+      };
+
+      detail::run_pipeline(generate, improve, stop, monitor, config, Q, pol, meter, observer);
+
+      // Calculate greedy policy
+      for(auto state : range(nstates)){
+        pol(state) = argmax_q(Q, state, feasible);
+      }
+
+      return make_tuple(Q.to_mat(), pol);
+    }
+
+    //! Pipelined Monte Carlo control with epsilon-soft policies, printing the progress every 10000 iterations
+    template<typename ValueT = double, typename CountT = uint64_t, typename DiscretizedModelT, typename EpisodeFuncT>
+    tuple<Mat<ValueT>,uvec> run_mc_eps_soft_pipeline(const DiscretizedModelT & discrete_model,
+                                                     EpisodeFuncT episode,
+                                                     const StoppingCriteria & stop,
+                                                     RunReport & report,
+                                                     double epsilon = 0.1,
+                                                     const PipelineConfig & config = PipelineConfig()){
+      return run_mc_eps_soft_pipeline<ValueT,CountT>(discrete_model, episode, stop, report, epsilon, config, ProgressObserver<>());
+    }
+
+  }
+}
@@ -19,13 +19,15 @@
 
 #pragma once
 
+#include <cstdlib>
 #include <stdexcept>
+#include <string>
 #include <vector>
 #include <tuple>
 #include <armadillo>
 #include "mc-control/utils.hpp"
 #include "mc-control/distribution.hpp"
-//#include "mc-control/model.hpp"
+#include "mc-control/npy.hpp"
 
 using namespace std;
 using namespace arma;
@@ -36,144 +38,129 @@ namespace mc{
 
   namespace plot{
 
-    template<typename ProblemT>
-    void plot_q(const mat & Q, const uvec & pol, const ProblemT & problem){
-
-      cout << "Plotting the Q-values!" << endl;
-
-      // Open file
-      ofstream file;
-      file.open ("plot.py");
-
-      // Imports
-      file << "import numpy as np" << endl;
-      file << "import matplotlib.pyplot as plt" << endl;
-      file << "from matplotlib import cm" << endl;
-      file << "from mpl_toolkits.mplot3d import Axes3D" << endl;
-
-      // Initiate plotting
-      file << "plt.style.use('ggplot')" << endl;
-      // file << "fig = plt.figure()" << endl;
-      // file << "ax = fig.add_subplot(111,projection='3d')" << endl;
-
-      // // Colors
-      // file << "colors = [hex['color'] for hex in list(plt.rcParams['axes.prop_cycle'])]" << endl;
-      // file << "ncolors = len(colors)" << endl;
-      // file << "coli = 0" << endl;
-
-
-      // Write state and action values to arrays
-      file << "state_values = []" << endl;
-      for(auto bin_x : problem.bins[0]){
-        file << "state_values.append(" << bin_x << ")" << endl;
+    //! Script that plots the exported files, relative to the working directory
+    const string plot_script = "python/plot.py";
+
+    /*! Writes the Q-values, the policy and the state and action grids into an .npz file
+     *
+     *  The arrays are
+     *
+     *    Q              (nstates x nactions) Q-values
+     *    policy         action index of each state
+     *    policy_actions action value of each state
+     *    actions        action values
+     *    state_values   (nstates x nvariables) values of the state variables of each state
+     *    nbins          # of bins of each state variable
+     *    bins_i         bin edges of variable i
+     *    bin_values_i   bin values of variable i
+     *
+     *  The matrices are written from memory as they are, so exporting takes about as long as
+     *   writing the bytes. Plot with "python python/plot.py q path".
+     *
+     *  @param path    .npz file to write
+     *  @param Q       Q-values, as returned by the algorithms (written as float32 for an fmat)
+     *  @param pol     policy, as returned by the algorithms
+     *  @param problem the discretized model
+     */
+    template<typename ValueT, typename ProblemT>
+    void export_q(const string & path, const Mat<ValueT> & Q, const uvec & pol, const ProblemT & problem){
+
+      vec policy_actions(pol.size());
+      for(auto i : range(pol.size())){
+        policy_actions(i) = problem.actions(pol(i));
       }
-
-      file << "action_values = []" << endl;
-      for(auto action  : range(Q.n_cols)){
-        file << "action_values.append(" << problem.actions(action) << ")" << endl;
+      uvec nbins(problem.bin_values.size());
+      for(auto var_i : range(problem.bin_values.size())){
+        nbins(var_i) = problem.bin_values[var_i].size();
       }
-
-      // Create Q-value matrix
-      file << "Q = np.zeros((len(state_values), len(action_values)))" << endl;
-      for(auto state  : range(Q.n_rows)){
-        for(auto action  : range(Q.n_cols)){
-          file << "Q[" << state << "," << action << "] = " << Q(state,action)<< endl;
+      mat state_values(problem.state_space_size, problem.bin_values.size());
+      for(auto state : range(problem.state_space_size)){
+        auto value = problem.state_value(state);
+        for(auto var_i : range(problem.bin_values.size())){
+          state_values(state, var_i) = value(var_i);
         }
       }
 
-      file << "X,Y = np.meshgrid(state_values, action_values)" << endl;
-      file << "plt.contourf(X,Y,Q.T, cmap=plt.get_cmap('summer'))" << endl;
-
-      // Plot the optimal policy pol
-      vec pol_x = problem.state_values;
-      vec pol_y(pol.size());
-      for(auto i : range(pol.size())){
-        pol_y(i) = problem.actions(pol(i));
+      mc::io::NpzWriter npz(path);
+      npz.add("Q", Q);
+      npz.add("policy", pol);
+      npz.add("policy_actions", policy_actions);
+      npz.add("actions", problem.actions);
+      npz.add("state_values", state_values);
+      npz.add("nbins", nbins);
+      for(auto var_i : range(problem.bins.size())){
+        npz.add("bins_" + to_string(var_i), problem.bins[var_i]);
+        npz.add("bin_values_" + to_string(var_i), problem.bin_values[var_i]);
       }
-      file << "pol_x = []" << endl;
-      file << "pol_y = []" << endl;
-      for(auto i : range(pol.size())){
-        file << "pol_x.append(" << pol_x(i) << ")" << endl;
-        file << "pol_y.append(" << pol_y(i) << ")" << endl;
-      }
-
-      //file << "plt.plot(pol_x,pol_x)" << endl;
-      file << "plt.plot(pol_x,pol_y, color='#A0522D')" << endl;
-
-      // Title and labels
-      file << "plt.xlabel('State')" << endl;
-      file << "plt.ylabel('Action')" << endl;
-      file << "plt.title('Q-value')" << endl;
-
-      // Some text
-      file << "plt.text(0.8*pol_x[len(pol_x)-1], 1.1 * pol_y[len(pol_y)-1], 'Optimal policy', color='#A0522D', fontsize=12)" << endl;
+      npz.commit();
+    }
 
-      file << "plt.show()" << endl;
+    /*! Writes the densities of the transition distributions into an .npz file
+     *
+     *  The arrays are
+     *
+     *    actions        action values
+     *    densities_i    (nactions x nbins) density of state variable i after each action
+     *    bins_i         bin edges of variable i
+     *    bin_values_i   bin values of variable i
+     *
+     *  Plot with "python python/plot.py distributions path".
+     *
+     *  @param path    .npz file to write
+     *  @param distr   distribution of the next state for each action
+     *  @param actions action values
+     */
+    template<typename RealT>
+    void export_distributions(const string & path, const vector<BasicDiscreteDistribution<RealT> > & distr, const vec & actions){
 
-      file.close();
+      size_t nactions = actions.size();
+      size_t nvariables = distr[0].nvariables;
+
+      mc::io::NpzWriter npz(path);
+      npz.add("actions", actions);
+      for(auto var_i : range(nvariables)){
+        size_t nbins = distr[0].densities[var_i].size();
+        mat densities(nactions, nbins);
+        for(auto action : range(nactions)){
+          for(auto bin_i : range(nbins)){
+            densities(action, bin_i) = distr[action].densities[var_i](bin_i);
+          }
+        }
+        npz.add("densities_" + to_string(var_i), densities);
+        npz.add("bins_" + to_string(var_i), distr[0].bins[var_i]);
+        npz.add("bin_values_" + to_string(var_i), distr[0].bin_values[var_i]);
+      }
+      npz.commit();
+    }
 
-      system ("python plot.py");
+    /*! Exports the Q-values and the policy to q_values.npz and shows them with the plotting script
+     *
+     *  @param script the plotting script (see plot_script)
+     */
+    template<typename ValueT, typename ProblemT>
+    void plot_q(const Mat<ValueT> & Q, const uvec & pol, const ProblemT & problem, const string & script = plot_script){
 
+      cout << "Plotting the Q-values!" << endl;
 
+      export_q("q_values.npz", Q, pol, problem);
+      if(system(("python " + script + " q q_values.npz").c_str()) != 0){
+        cout << "Plotting failed, the Q-values are in q_values.npz" << endl;
+      }
     };
 
-    void plot_distr(const vector<DiscreteDistribution> & distr, const vec & actions){
+    /*! Exports the densities to distributions.npz and shows them with the plotting script
+     *
+     *  @param script the plotting script (see plot_script)
+     */
+    template<typename RealT>
+    void plot_distr(const vector<BasicDiscreteDistribution<RealT> > & distr, const vec & actions, const string & script = plot_script){
 
       cout << "Plotting the distribution!" << endl;
-      // Only works for one-dim states for now
-      if (distr[0].nvariables > 1){
-        throw invalid_argument("Plotting only works on one-dimensional states for now...");
-      }
-      // Open file
-      ofstream file;
-      file.open ("plot.py");
-
-      // Imports
-      file << "import numpy as np" << endl;
-      file << "import matplotlib.pyplot as plt" << endl;
-      file << "from matplotlib import cm" << endl;
-      file << "from mpl_toolkits.mplot3d import Axes3D" << endl;
-
-      // Initiate plotting
-      file << "plt.style.use('ggplot')" << endl;
-      file << "fig = plt.figure()" << endl;
-      file << "ax = fig.add_subplot(111,projection='3d')" << endl;
-
-      // Colors
-      file << "colors = [hex['color'] for hex in list(plt.rcParams['axes.prop_cycle'])]" << endl;
-      file << "ncolors = len(colors)" << endl;
-      file << "coli = 0" << endl;
-
-      // For each action
-      size_t nactions = actions.size();
-      for (auto action : range(nactions)){
-        file << "bins = []" << endl;
-        file << "density = []" << endl;
-        file << "width = " << distr[action].bin_widths(0) << endl;
-
-        for(auto bin_i : range(distr[action].nbins[0]-1)){
-          file << "bins.append(" << distr[action].bins[0](bin_i) << ")" << endl;
-          file << "density.append(" << distr[action].densities[0](bin_i) << ")" << endl;
-        }
-
-        file << "ax.bar(bins, density, np.zeros(len(bins))+" << actions(action) << ", zdir='y',  alpha=0.8, color=colors[coli], width=width)" << endl;
 
-        // Cycle colors
-        file << "if coli >= (ncolors-1):" << endl;
-        file << "    coli = 0" << endl;
-        file << "else:" << endl;
-        file << "    coli += 1" << endl;
+      export_distributions("distributions.npz", distr, actions);
+      if(system(("python " + script + " distributions distributions.npz").c_str()) != 0){
+        cout << "Plotting failed, the densities are in distributions.npz" << endl;
       }
-      file << "ax.set_xlabel('State')" << endl;
-      file << "ax.set_ylabel('Action')" << endl;
-      file << "ax.set_zlabel('Density')" << endl;
-      file << "plt.show()" << endl;
-
-      file.close();
-
-      system ("python plot.py");
-
-
     }
 
   }
@@ -0,0 +1,827 @@
+/* Q-value tables for Monte Carlo optimal control
+ *
+ * Copyright (C) 2016  Jarno Kiviaho <jarkki@kapsi.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <memory>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include <armadillo>
+#include "mc-control/utils.hpp"
+
+using namespace std;
+using namespace arma;
+using namespace mc::utils;
+
+namespace mc{
+
+  namespace tables{
+
+    /*! Q-values and visit counts of all state, action pairs
+     *
+     *
+     *  The table is stored state by state: the block of a state holds the Q-values of all its actions
+     *   followed by their visit counts, and each block starts on a cache line. Updating (s,a) and
+     *   scanning the actions of a state touch only that state's block, and the Q-values of a state
+     *   are contiguous.
+     *
+     *  The Q-value is kept as an incremental mean of the returns, so the sum of the returns is not
+     *   stored:
+     *
+     *    n(s,a) += 1,  Q(s,a) += (G - Q(s,a)) / n(s,a)
+     *
+     *  @tparam ValueT type of the Q-values (e.g. double or float)
+     *  @tparam CountT type of the visit counts (e.g. uint64_t or uint32_t)
+     *
+     *  Example usage:
+     *  @code
+     *   QTable<float, uint32_t> Q(nstates, nactions);
+     *   Q.update(state, action, G);
+     *   fmat Qmat = Q.to_mat();
+     *  @endcode
+     */
+    template<typename ValueT = double, typename CountT = uint64_t>
+    class QTable{
+    public:
+      typedef ValueT value_type;
+      typedef CountT count_type;
+
+      //! Size of a cache line, the alignment of the state blocks
+      static const size_t alignment = 64;
+
+      QTable(){
+        this->init(0, 0);
+      }
+
+      //! Table of zero Q-values and counts
+      QTable(const size_t & nstates, const size_t & nactions){
+        this->init(nstates, nactions);
+      }
+
+      /*! Table over memory owned by someone else, e.g. a memory-mapped checkpoint
+       *
+       *  data has to start on a cache line and hold nstates blocks in the layout of this table. owner
+       *   keeps the memory alive for as long as the table (or a copy of it) uses it.
+       */
+      QTable(const size_t & nstates, const size_t & nactions, unsigned char * data, const shared_ptr<void> & owner){
+        this->layout(nstates, nactions);
+        this->base = data;
+        this->owner = owner;
+      }
+
+      //! Copies always own their memory
+      QTable(const QTable & other){
+        this->init(other.nstates, other.nactions);
+        std::memcpy(this->data(), other.data(), this->nstates * this->block_bytes);
+      }
+
+      QTable(QTable && other){
+        this->take(other);
+      }
+
+      QTable & operator=(const QTable & other){
+        if(this != &other){
+          this->init(other.nstates, other.nactions);
+          std::memcpy(this->data(), other.data(), this->nstates * this->block_bytes);
+        }
+        return *this;
+      }
+
+      QTable & operator=(QTable && other){
+        if(this != &other){
+          this->take(other);
+        }
+        return *this;
+      }
+
+      //! Q-values of the actions of a state
+      ValueT * values(const size_t & state){
+        return reinterpret_cast<ValueT *>(this->data() + state * this->block_bytes);
+      }
+      const ValueT * values(const size_t & state) const{
+        return reinterpret_cast<const ValueT *>(this->data() + state * this->block_bytes);
+      }
+
+      //! Visit counts of the actions of a state
+      CountT * counts(const size_t & state){
+        return reinterpret_cast<CountT *>(this->data() + state * this->block_bytes + this->counts_offset);
+      }
+      const CountT * counts(const size_t & state) const{
+        return reinterpret_cast<const CountT *>(this->data() + state * this->block_bytes + this->counts_offset);
+      }
+
+      //! Q-value of (state, action)
+      ValueT q(const size_t & state, const size_t & action) const{
+        return this->values(state)[action];
+      }
+
+      //! Visit count of (state, action)
+      CountT count(const size_t & state, const size_t & action) const{
+        return this->counts(state)[action];
+      }
+
+      //! Adds a return to the mean of (state, action). Returns the change of the Q-value.
+      ValueT update(const size_t & state, const size_t & action, const double & ret){
+        ValueT & q = this->values(state)[action];
+        CountT & n = this->counts(state)[action];
+        n += 1;
+        ValueT delta = static_cast<ValueT>((ret - q) / n);
+        q += delta;
+        return delta;
+      }
+
+      /*! Combines the mean of count returns with the mean of (state, action)
+       *
+       *  Used for merging tables filled from different episodes. Returns the change of the Q-value.
+       */
+      ValueT merge(const size_t & state, const size_t & action, const double & mean, const CountT & count){
+        if(count == 0){
+          return 0;
+        }
+        ValueT & q = this->values(state)[action];
+        CountT & n = this->counts(state)[action];
+        n += count;
+        ValueT delta = static_cast<ValueT>((mean - q) * (static_cast<double>(count) / n));
+        q += delta;
+        return delta;
+      }
+
+      //! Resets (state, action) to zero Q-value and count
+      void reset(const size_t & state, const size_t & action){
+        this->values(state)[action] = 0;
+        this->counts(state)[action] = 0;
+      }
+
+      //! Resets all Q-values and counts to zero
+      void zeros(){
+        std::memset(this->data(), 0, this->nstates * this->block_bytes);
+      }
+
+      //! Q-values as a (nstates x nactions) matrix of ValueT
+      Mat<ValueT> to_mat() const{
+        Mat<ValueT> Q(this->nstates, this->nactions);
+        for(size_t state = 0; state < this->nstates; ++state){
+          const ValueT * v = this->values(state);
+          for(size_t action = 0; action < this->nactions; ++action){
+            Q(state,action) = v[action];
+          }
+        }
+        return Q;
+      }
+
+      //! Visit counts as a (nstates x nactions) matrix
+      mat counts_mat() const{
+        mat counter(this->nstates, this->nactions);
+        for(size_t state = 0; state < this->nstates; ++state){
+          const CountT * n = this->counts(state);
+          for(size_t action = 0; action < this->nactions; ++action){
+            counter(state,action) = n[action];
+          }
+        }
+        return counter;
+      }
+
+      //! # of state, action pairs with a nonzero count
+      size_t nvisited_pairs() const{
+        size_t n = 0;
+        for(size_t state = 0; state < this->nstates; ++state){
+          const CountT * c = this->counts(state);
+          for(size_t action = 0; action < this->nactions; ++action){
+            n += c[action] > 0;
+          }
+        }
+        return n;
+      }
+
+      //! Bytes used by the table
+      size_t memory_bytes() const{
+        return this->owner ? this->nstates * this->block_bytes : this->storage.size();
+      }
+
+      //! Bytes of one state block (Q-values, counts and padding)
+      size_t block_size() const{
+        return this->block_bytes;
+      }
+
+      //! The state blocks, nstates * block_size() bytes starting on a cache line
+      unsigned char * data(){
+        return this->base;
+      }
+      const unsigned char * data() const{
+        return this->base;
+      }
+
+      size_t nstates;
+      size_t nactions;
+
+    private:
+
+      void layout(size_t nstates, size_t nactions){
+        this->nstates = nstates;
+        this->nactions = nactions;
+        this->counts_offset = round_up(nactions * sizeof(ValueT), sizeof(CountT));
+        this->block_bytes = round_up(this->counts_offset + nactions * sizeof(CountT), alignment);
+      }
+
+      void init(size_t nstates, size_t nactions){
+        this->layout(nstates, nactions);
+        this->owner.reset();
+        this->storage.assign(nstates * this->block_bytes + alignment, 0);
+
+        // First cache line aligned byte of the storage
+        uintptr_t p = reinterpret_cast<uintptr_t>(this->storage.data());
+        this->base = this->storage.data() + (alignment - p % alignment) % alignment;
+      }
+
+      void take(QTable & other){
+        this->layout(other.nstates, other.nactions);
+        this->storage.swap(other.storage);
+        this->owner = other.owner;
+        this->base = other.base;
+        other.init(0, 0);
+      }
+
+      static size_t round_up(size_t n, size_t multiple){
+        return (n + multiple - 1) / multiple * multiple;
+      }
+
+      size_t counts_offset;
+      size_t block_bytes;
+      unsigned char * base;
+      vector<unsigned char> storage;
+      shared_ptr<void> owner;
+    };
+
+    namespace detail{
+
+      //! Action in possible_a with the max of the Q-values q, ties broken uniformly at random
+      template<typename ValueT>
+      size_t argmax_possible(const ValueT * q, const uvec & possible_a){
+        size_t best = possible_a(0);
+        ValueT maxq = q[best];
+        size_t nties = 1;
+        for(size_t i = 1; i < possible_a.size(); ++i){
+          size_t action = possible_a(i);
+          if(q[action] > maxq){
+            maxq = q[action];
+            best = action;
+            nties = 1;
+          }else if(q[action] == maxq){
+            // Keep each of the actions with the max Q-value with equal probability
+            nties += 1;
+            if(randint(nties) == 0){
+              best = action;
+            }
+          }
+        }
+        return best;
+      }
+    }
+
+    /*! Returns the action that maximizes the Q-value for the given state
+     *
+     *  Same as mc::utils::argmax_q for a QTable: ties are broken uniformly at random.
+     */
+    template<typename ValueT, typename CountT>
+    size_t argmax_q(const QTable<ValueT,CountT> & Q, const size_t & state, const uvec & possible_a){
+      return detail::argmax_possible(Q.values(state), possible_a);
+    }
+
+    namespace detail{
+
+      //! Max of q[0..n-1], n > 0
+      template<typename ValueT>
+      ValueT max_value(const ValueT * q, size_t n){
+        ValueT maxq = q[0];
+        for(size_t i = 1; i < n; ++i){
+          maxq = q[i] > maxq ? q[i] : maxq;
+        }
+        return maxq;
+      }
+
+#if defined(__AVX__)
+      inline double max_value(const double * q, size_t n){
+        size_t i = 0;
+        double maxq = q[0];
+        if(n >= 4){
+          __m256d m = _mm256_loadu_pd(q);
+          for(i = 4; i + 4 <= n; i += 4){
+            m = _mm256_max_pd(m, _mm256_loadu_pd(q + i));
+          }
+          __m128d h = _mm_max_pd(_mm256_castpd256_pd128(m), _mm256_extractf128_pd(m, 1));
+          h = _mm_max_sd(h, _mm_unpackhi_pd(h, h));
+          maxq = _mm_cvtsd_f64(h);
+        }
+        for(; i < n; ++i){
+          maxq = q[i] > maxq ? q[i] : maxq;
+        }
+        return maxq;
+      }
+
+      inline float max_value(const float * q, size_t n){
+        size_t i = 0;
+        float maxq = q[0];
+        if(n >= 8){
+          __m256 m = _mm256_loadu_ps(q);
+          for(i = 8; i + 8 <= n; i += 8){
+            m = _mm256_max_ps(m, _mm256_loadu_ps(q + i));
+          }
+          __m128 h = _mm_max_ps(_mm256_castps256_ps128(m), _mm256_extractf128_ps(m, 1));
+          h = _mm_max_ps(h, _mm_movehl_ps(h, h));
+          h = _mm_max_ss(h, _mm_shuffle_ps(h, h, 1));
+          maxq = _mm_cvtss_f32(h);
+        }
+        for(; i < n; ++i){
+          maxq = q[i] > maxq ? q[i] : maxq;
+        }
+        return maxq;
+      }
+#elif defined(__SSE2__)
+      inline double max_value(const double * q, size_t n){
+        size_t i = 0;
+        double maxq = q[0];
+        if(n >= 2){
+          __m128d m = _mm_loadu_pd(q);
+          for(i = 2; i + 2 <= n; i += 2){
+            m = _mm_max_pd(m, _mm_loadu_pd(q + i));
+          }
+          m = _mm_max_sd(m, _mm_unpackhi_pd(m, m));
+          maxq = _mm_cvtsd_f64(m);
+        }
+        for(; i < n; ++i){
+          maxq = q[i] > maxq ? q[i] : maxq;
+        }
+        return maxq;
+      }
+
+      inline float max_value(const float * q, size_t n){
+        size_t i = 0;
+        float maxq = q[0];
+        if(n >= 4){
+          __m128 m = _mm_loadu_ps(q);
+          for(i = 4; i + 4 <= n; i += 4){
+            m = _mm_max_ps(m, _mm_loadu_ps(q + i));
+          }
+          m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+          m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+          maxq = _mm_cvtss_f32(m);
+        }
+        for(; i < n; ++i){
+          maxq = q[i] > maxq ? q[i] : maxq;
+        }
+        return maxq;
+      }
+#endif
+
+      //! Index of a uniformly random element of q[0..n-1] equal to maxq (at least one is)
+      template<typename ValueT>
+      size_t random_max_index(const ValueT * q, size_t n, ValueT maxq){
+        size_t nties = 0;
+        for(size_t i = 0; i < n; ++i){
+          nties += (q[i] == maxq);
+        }
+        size_t k = nties > 1 ? randint(nties) : 0;
+        for(size_t i = 0; i < n; ++i){
+          if(q[i] == maxq){
+            if(k == 0){
+              return i;
+            }
+            k -= 1;
+          }
+        }
+        return n - 1;
+      }
+    }
+
+    namespace detail{
+
+      //! Feasible action of the state with the max of the Q-values q, see argmax_q
+      template<typename ValueT>
+      size_t argmax_feasible(const ValueT * q, const size_t & state, const FeasibleActions & feasible){
+
+        size_t lo = feasible.lo[state];
+        size_t hi = feasible.hi[state];
+
+        if(feasible.is_range(state)){
+          ValueT maxq = detail::max_value(q + lo, hi - lo);
+          return lo + detail::random_max_index(q + lo, hi - lo, maxq);
+        }
+
+        // Bitmask: single pass with reservoir sampling over the ties
+        const uint64_t * words = feasible.mask(state);
+        size_t best = lo;
+        ValueT maxq = q[lo];
+        size_t nties = 0;
+        for(size_t w = lo / 64; w * 64 < hi; ++w){
+          uint64_t word = words[w];
+          while(word){
+            size_t action = w * 64 + __builtin_ctzll(word);
+            word &= word - 1;
+            if(nties == 0 || q[action] > maxq){
+              maxq = q[action];
+              best = action;
+              nties = 1;
+            }else if(q[action] == maxq){
+              nties += 1;
+              if(randint(nties) == 0){
+                best = action;
+              }
+            }
+          }
+        }
+        return best;
+      }
+    }
+
+    /*! Returns the feasible action that maximizes the Q-value for the given state
+     *
+     *  For a range of feasible actions the Q-values are contiguous in the table: the max is found with
+     *   SIMD instructions (AVX or SSE2 when available) and the ties are counted in a second pass over the
+     *   same cache lines. Bitmask states visit the set bits only. Ties are broken uniformly at random,
+     *   with a single random draw and no allocations.
+     */
+    template<typename ValueT, typename CountT>
+    size_t argmax_q(const QTable<ValueT,CountT> & Q, const size_t & state, const FeasibleActions & feasible){
+      return detail::argmax_feasible(Q.values(state), state, feasible);
+    }
+
+    /*! Q-values and visit counts of the visited states only
+     *
+     *
+     *  For state grids whose Cartesian product is too large for a QTable. The blocks of the states
+     *   have the layout of QTable (Q-values, then counts, padded to a cache line), but a block is
+     *   allocated only when the state is first written. An open-addressing hash on the state index
+     *   maps the states to their blocks, which are allocated from chunks of 64 blocks, so the memory
+     *   is proportional to the number of visited states.
+     *
+     *  Reading an unvisited state allocates nothing: the const accessors return a block of zeros.
+     *   The non-const values() and counts() allocate the block, so read through a const reference
+     *   (as argmax_q does) when the state may be unvisited.
+     *
+     *  Example usage:
+     *  @code
+     *   SparseQTable<> Q(nstates, nactions);
+     *   Q.update(state, action, G);
+     *   cout << Q.nvisited() << " states use " << Q.memory_bytes() << " bytes" << endl;
+     *  @endcode
+     */
+    template<typename ValueT = double, typename CountT = uint64_t>
+    class SparseQTable{
+    public:
+      typedef ValueT value_type;
+      typedef CountT count_type;
+
+      //! Size of a cache line, the alignment of the state blocks
+      static const size_t alignment = 64;
+
+      //! # of blocks allocated at a time
+      static const size_t chunk_blocks = 64;
+
+      SparseQTable(){
+        this->init(0, 0, 16);
+      }
+
+      /*! Table with no visited states
+       *
+       *  @param expected_states # of states to make room for in the hash without rehashing
+       */
+      SparseQTable(const size_t & nstates, const size_t & nactions, const size_t & expected_states = 1024){
+        this->init(nstates, nactions, expected_states);
+      }
+
+      SparseQTable(const SparseQTable & other){
+        this->copy(other);
+      }
+
+      SparseQTable(SparseQTable && other){
+        this->take(other);
+      }
+
+      SparseQTable & operator=(const SparseQTable & other){
+        if(this != &other){
+          this->copy(other);
+        }
+        return *this;
+      }
+
+      SparseQTable & operator=(SparseQTable && other){
+        if(this != &other){
+          this->take(other);
+        }
+        return *this;
+      }
+
+      //! Q-values of the actions of a state, allocating its block
+      ValueT * values(const size_t & state){
+        return reinterpret_cast<ValueT *>(this->block(state));
+      }
+      //! Q-values of the actions of a state, zeros for an unvisited state
+      const ValueT * values(const size_t & state) const{
+        const unsigned char * b = this->find(state);
+        return b ? reinterpret_cast<const ValueT *>(b) : this->zero_values.data();
+      }
+
+      //! Visit counts of the actions of a state, allocating its block
+      CountT * counts(const size_t & state){
+        return reinterpret_cast<CountT *>(this->block(state) + this->counts_offset);
+      }
+      //! Visit counts of the actions of a state, zeros for an unvisited state
+      const CountT * counts(const size_t & state) const{
+        const unsigned char * b = this->find(state);
+        return b ? reinterpret_cast<const CountT *>(b + this->counts_offset) : this->zero_counts.data();
+      }
+
+      //! Q-value of (state, action)
+      ValueT q(const size_t & state, const size_t & action) const{
+        return this->values(state)[action];
+      }
+
+      //! Visit count of (state, action)
+      CountT count(const size_t & state, const size_t & action) const{
+        return this->counts(state)[action];
+      }
+
+      //! Adds a return to the mean of (state, action). Returns the change of the Q-value.
+      ValueT update(const size_t & state, const size_t & action, const double & ret){
+        unsigned char * b = this->block(state);
+        ValueT & q = reinterpret_cast<ValueT *>(b)[action];
+        CountT & n = reinterpret_cast<CountT *>(b + this->counts_offset)[action];
+        n += 1;
+        ValueT delta = static_cast<ValueT>((ret - q) / n);
+        q += delta;
+        return delta;
+      }
+
+      //! Combines the mean of count returns with the mean of (state, action), see QTable::merge
+      ValueT merge(const size_t & state, const size_t & action, const double & mean, const CountT & count){
+        if(count == 0){
+          return 0;
+        }
+        unsigned char * b = this->block(state);
+        ValueT & q = reinterpret_cast<ValueT *>(b)[action];
+        CountT & n = reinterpret_cast<CountT *>(b + this->counts_offset)[action];
+        n += count;
+        ValueT delta = static_cast<ValueT>((mean - q) * (static_cast<double>(count) / n));
+        q += delta;
+        return delta;
+      }
+
+      //! Resets (state, action) to zero Q-value and count. The block of the state is kept.
+      void reset(const size_t & state, const size_t & action){
+        unsigned char * b = const_cast<unsigned char *>(this->find(state));
+        if(b){
+          reinterpret_cast<ValueT *>(b)[action] = 0;
+          reinterpret_cast<CountT *>(b + this->counts_offset)[action] = 0;
+        }
+      }
+
+      //! Forgets all the states and frees their blocks
+      void zeros(){
+        this->init(this->nstates, this->nactions, 16);
+      }
+
+      //! True if the state has a block
+      bool contains(const size_t & state) const{
+        return this->find(state) != nullptr;
+      }
+
+      //! # of states with a block
+      size_t nvisited() const{
+        return this->block_states.size();
+      }
+
+      //! The states with a block, in the order they were first written
+      const vector<size_t> & visited_states() const{
+        return this->block_states;
+      }
+
+      //! # of state, action pairs with a nonzero count
+      size_t nvisited_pairs() const{
+        size_t n = 0;
+        for(size_t i = 0; i < this->block_states.size(); ++i){
+          const CountT * c = reinterpret_cast<const CountT *>(this->block_at(i) + this->counts_offset);
+          for(size_t action = 0; action < this->nactions; ++action){
+            n += c[action] > 0;
+          }
+        }
+        return n;
+      }
+
+      /*! Q-values as a dense (nstates x nactions) matrix
+       *
+       *  Only for state spaces that would fit in a QTable, e.g. to compare the two.
+       */
+      Mat<ValueT> to_mat() const{
+        Mat<ValueT> Q = arma::zeros<Mat<ValueT> >(this->nstates, this->nactions);
+        for(size_t state : this->block_states){
+          const ValueT * v = this->values(state);
+          for(size_t action = 0; action < this->nactions; ++action){
+            Q(state,action) = v[action];
+          }
+        }
+        return Q;
+      }
+
+      //! Visit counts as a dense (nstates x nactions) matrix, see to_mat
+      mat counts_mat() const{
+        mat counter = arma::zeros<mat>(this->nstates, this->nactions);
+        for(size_t state : this->block_states){
+          const CountT * n = this->counts(state);
+          for(size_t action = 0; action < this->nactions; ++action){
+            counter(state,action) = n[action];
+          }
+        }
+        return counter;
+      }
+
+      //! Bytes used by the blocks, the hash and the bookkeeping
+      size_t memory_bytes() const{
+        return this->chunks.size() * (chunk_blocks * this->block_bytes + alignment)
+          + this->slots.capacity() * sizeof(Slot)
+          + this->block_states.capacity() * sizeof(size_t)
+          + this->bases.capacity() * sizeof(unsigned char *)
+          + this->nactions * (sizeof(ValueT) + sizeof(CountT));
+      }
+
+      //! Bytes of one state block (Q-values, counts and padding)
+      size_t block_size() const{
+        return this->block_bytes;
+      }
+
+      size_t nstates;
+      size_t nactions;
+
+    private:
+
+      //! Hash slot: a state and the index of its block
+      struct Slot{
+        uint64_t state;
+        uint64_t block;
+      };
+
+      static const uint64_t empty = ~static_cast<uint64_t>(0);
+
+      void init(size_t nstates, size_t nactions, size_t expected_states){
+        this->nstates = nstates;
+        this->nactions = nactions;
+        this->counts_offset = round_up(nactions * sizeof(ValueT), sizeof(CountT));
+        this->block_bytes = round_up(this->counts_offset + nactions * sizeof(CountT), alignment);
+        this->zero_values.assign(nactions, 0);
+        this->zero_counts.assign(nactions, 0);
+        this->chunks.clear();
+        this->bases.clear();
+        this->block_states.clear();
+        this->rehash(2 * expected_states);
+      }
+
+      void copy(const SparseQTable & other){
+        this->init(other.nstates, other.nactions, other.slots.size() / 2);
+        for(size_t i = 0; i < other.block_states.size(); ++i){
+          std::memcpy(this->block(other.block_states[i]), other.block_at(i), this->block_bytes);
+        }
+      }
+
+      //! Moves the blocks of other, whose addresses do not change, and leaves other empty
+      void take(SparseQTable & other){
+        this->nstates = other.nstates;
+        this->nactions = other.nactions;
+        this->counts_offset = other.counts_offset;
+        this->block_bytes = other.block_bytes;
+        this->mask = other.mask;
+        this->shift = other.shift;
+        this->slots.swap(other.slots);
+        this->chunks.swap(other.chunks);
+        this->bases.swap(other.bases);
+        this->block_states.swap(other.block_states);
+        this->zero_values.swap(other.zero_values);
+        this->zero_counts.swap(other.zero_counts);
+        other.init(0, 0, 16);
+      }
+
+      //! Home slot of a state, from the high bits of a Fibonacci hash
+      size_t home(uint64_t state) const{
+        return static_cast<size_t>((state * 0x9e3779b97f4a7c15ull) >> this->shift);
+      }
+
+      //! Block of the i-th visited state
+      unsigned char * block_at(size_t i) const{
+        return this->bases[i / chunk_blocks] + (i % chunk_blocks) * this->block_bytes;
+      }
+
+      //! Block of a state, nullptr if unvisited
+      const unsigned char * find(size_t state) const{
+        size_t i = this->home(state);
+        while(true){
+          const Slot & slot = this->slots[i];
+          if(slot.state == state){
+            return this->block_at(slot.block);
+          }
+          if(slot.state == empty){
+            return nullptr;
+          }
+          i = (i + 1) & this->mask;
+        }
+      }
+
+      //! Block of a state, allocated and zeroed on the first call
+      unsigned char * block(size_t state){
+        size_t i = this->home(state);
+        while(true){
+          Slot & slot = this->slots[i];
+          if(slot.state == state){
+            return this->block_at(slot.block);
+          }
+          if(slot.state == empty){
+            break;
+          }
+          i = (i + 1) & this->mask;
+        }
+
+        size_t index = this->block_states.size();
+        if(index % chunk_blocks == 0){
+          this->chunks.push_back(vector<unsigned char>(chunk_blocks * this->block_bytes + alignment, 0));
+          unsigned char * p = this->chunks.back().data();
+          this->bases.push_back(p + (alignment - reinterpret_cast<uintptr_t>(p) % alignment) % alignment);
+        }
+        this->block_states.push_back(state);
+        this->slots[i].state = state;
+        this->slots[i].block = index;
+
+        // Keep the load at most 1/2 so that the probe sequences stay short
+        if(2 * this->block_states.size() > this->slots.size()){
+          this->rehash(2 * this->slots.size());
+        }
+        return this->block_at(index);
+      }
+
+      //! Resizes the hash to at least nslots slots
+      void rehash(size_t nslots){
+        size_t n = 16;
+        this->shift = 60;
+        while(n < nslots){
+          n *= 2;
+          this->shift -= 1;
+        }
+        this->mask = n - 1;
+        Slot free_slot = {empty, 0};
+        this->slots.assign(n, free_slot);
+        for(size_t b = 0; b < this->block_states.size(); ++b){
+          size_t i = this->home(this->block_states[b]);
+          while(this->slots[i].state != empty){
+            i = (i + 1) & this->mask;
+          }
+          this->slots[i].state = this->block_states[b];
+          this->slots[i].block = b;
+        }
+      }
+
+      static size_t round_up(size_t n, size_t multiple){
+        return (n + multiple - 1) / multiple * multiple;
+      }
+
+      size_t counts_offset;
+      size_t block_bytes;
+      size_t mask;
+      unsigned int shift;
+      vector<Slot> slots;
+      vector<vector<unsigned char> > chunks;
+      vector<unsigned char *> bases;
+      vector<size_t> block_states;
+      vector<ValueT> zero_values;
+      vector<CountT> zero_counts;
+    };
+
+    //! Same as argmax_q for a QTable, unvisited states have zero Q-values
+    template<typename ValueT, typename CountT>
+    size_t argmax_q(const SparseQTable<ValueT,CountT> & Q, const size_t & state, const uvec & possible_a){
+      return detail::argmax_possible(Q.values(state), possible_a);
+    }
+
+    //! Same as argmax_q for a QTable, unvisited states have zero Q-values
+    template<typename ValueT, typename CountT>
+    size_t argmax_q(const SparseQTable<ValueT,CountT> & Q, const size_t & state, const FeasibleActions & feasible){
+      return detail::argmax_feasible(Q.values(state), state, feasible);
+    }
+
+  }
+}
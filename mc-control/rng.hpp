@@ -0,0 +1,279 @@
+/* Random number generation for Monte Carlo optimal control
+ *
+ * Copyright (C) 2016  Jarno Kiviaho <jarkki@kapsi.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <random>
+
+namespace mc{
+
+  namespace rng{
+
+    //! Seed of the engines that have not been seeded explicitly
+    const uint64_t default_seed = 0x5eed5eed5eed5eedULL;
+
+    //! SplitMix64 step, used to expand seeds into engine states
+    inline uint64_t splitmix64(uint64_t & x){
+      uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+      return z ^ (z >> 31);
+    }
+
+    /*! xoshiro256** random number engine with stream splitting
+     *
+     *
+     *  http://prng.di.unimi.it/
+     *
+     *  The engine is a few 64-bit words, draws do not allocate, and the state can be copied
+     *   around freely. An engine is identified by a seed and a stream number: engines with the
+     *   same seed and different streams produce independent sequences, so each worker of a
+     *   parallel run can get its own stream and the results only depend on the seed and the
+     *   worker numbering, not on which thread runs which worker.
+     *
+     *  Satisfies the UniformRandomBitGenerator requirements, so it also works with <random>.
+     *
+     *  Example usage:
+     *  @code
+     *   Xoshiro256 rng(42);
+     *   double u = rng.uniform();
+     *   Xoshiro256 worker_rng = rng.split(3);
+     *  @endcode
+     */
+    class Xoshiro256{
+    public:
+      typedef uint64_t result_type;
+
+      explicit Xoshiro256(uint64_t seed = default_seed, uint64_t stream = 0){
+        this->seed(seed, stream);
+      }
+
+      //! Resets the engine to the start of the given seed and stream
+      void seed(uint64_t seed, uint64_t stream = 0){
+        uint64_t x = seed;
+        uint64_t key = splitmix64(x);
+        uint64_t y = stream;
+        x = key ^ splitmix64(y);
+        for(int i = 0; i < 4; ++i){
+          this->s[i] = splitmix64(x);
+        }
+        this->has_spare = false;
+        this->spare = 0.0;
+      }
+
+      /*! Returns an independent engine for the given stream
+       *
+       *  The child is a function of this engine's current state and the stream number only.
+       */
+      Xoshiro256 split(uint64_t stream) const{
+        uint64_t x = this->s[0] ^ rotl(this->s[1], 17) ^ rotl(this->s[2], 31) ^ rotl(this->s[3], 47);
+        return Xoshiro256(splitmix64(x), stream);
+      }
+
+      static constexpr result_type min(){ return 0; }
+      static constexpr result_type max(){ return ~static_cast<uint64_t>(0); }
+
+      //! Next 64 random bits
+      result_type operator()(){
+        const uint64_t result = rotl(this->s[1] * 5, 7) * 9;
+        const uint64_t t = this->s[1] << 17;
+        this->s[2] ^= this->s[0];
+        this->s[3] ^= this->s[1];
+        this->s[1] ^= this->s[2];
+        this->s[0] ^= this->s[3];
+        this->s[2] ^= t;
+        this->s[3] = rotl(this->s[3], 45);
+        return result;
+      }
+
+      /*! Advances the engine by 2^128 draws
+       *
+       *  Calling jump() k times on copies of an engine gives k non-overlapping subsequences.
+       */
+      void jump(){
+        static const uint64_t JUMP[] = { 0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+                                         0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL };
+        uint64_t t[4] = {0, 0, 0, 0};
+        for(int i = 0; i < 4; ++i){
+          for(int b = 0; b < 64; ++b){
+            if(JUMP[i] & (static_cast<uint64_t>(1) << b)){
+              for(int j = 0; j < 4; ++j){
+                t[j] ^= this->s[j];
+              }
+            }
+            (*this)();
+          }
+        }
+        for(int j = 0; j < 4; ++j){
+          this->s[j] = t[j];
+        }
+      }
+
+      //! Single draw from U(0,1), 53 random bits
+      double uniform(){
+        return ((*this)() >> 11) * (1.0 / 9007199254740992.0);
+      }
+
+      //! Single draw from U(a,b)
+      double uniform(double a, double b){
+        return a + (b - a) * this->uniform();
+      }
+
+      //! Single draw from N(0,1) (Marsaglia polar method)
+      double norm(){
+        if(this->has_spare){
+          this->has_spare = false;
+          return this->spare;
+        }
+        double u, v, r;
+        do{
+          u = 2.0 * this->uniform() - 1.0;
+          v = 2.0 * this->uniform() - 1.0;
+          r = u * u + v * v;
+        }while(r >= 1.0 || r == 0.0);
+        double f = std::sqrt(-2.0 * std::log(r) / r);
+        this->spare = v * f;
+        this->has_spare = true;
+        return u * f;
+      }
+
+      //! Single draw from N(mu,sigma)
+      double norm(double mu, double sigma){
+        return mu + sigma * this->norm();
+      }
+
+      //! Random integer in [0,n-1] (Lemire's multiply-shift with rejection, no modulo bias)
+      uint64_t randint(uint64_t n){
+        uint64_t x = (*this)();
+        unsigned __int128 m = static_cast<unsigned __int128>(x) * n;
+        uint64_t l = static_cast<uint64_t>(m);
+        if(l < n){
+          uint64_t threshold = (0 - n) % n;
+          while(l < threshold){
+            x = (*this)();
+            m = static_cast<unsigned __int128>(x) * n;
+            l = static_cast<uint64_t>(m);
+          }
+        }
+        return static_cast<uint64_t>(m >> 64);
+      }
+
+      //! Random integer in [a,b]
+      int randint(int a, int b){
+        return a + static_cast<int>(this->randint(static_cast<uint64_t>(static_cast<int64_t>(b) - a + 1)));
+      }
+
+      //! Fills out[0..n-1] with draws from U(0,1)
+      void uniform(double * out, size_t n){
+        for(size_t i = 0; i < n; ++i){
+          out[i] = this->uniform();
+        }
+      }
+
+      //! Fills out[0..n-1] with draws from N(0,1)
+      void norm(double * out, size_t n){
+        for(size_t i = 0; i < n; ++i){
+          out[i] = this->norm();
+        }
+      }
+
+      uint64_t s[4];
+      bool has_spare;
+      double spare;
+
+    private:
+      static uint64_t rotl(const uint64_t x, int k){
+        return (x << k) | (x >> (64 - k));
+      }
+    };
+
+    //! The engine type used throughout the library
+    typedef Xoshiro256 Engine;
+
+    namespace detail{
+
+      //! Engine owned by the calling thread
+      inline Engine & thread_engine(){
+        static thread_local Engine engine;
+        return engine;
+      }
+
+      //! Engine currently bound to the calling thread (nullptr = use thread_engine())
+      inline Engine *& bound_engine(){
+        static thread_local Engine * engine = nullptr;
+        return engine;
+      }
+    }
+
+    /*! Returns the engine of the calling thread
+     *
+     *  This is the engine used by mc::utils::uniform(), norm(), randint() and by the
+     *   sampling functions that are not given an engine explicitly. Every thread has its own,
+     *   so the draws are thread-safe. Inside the parallel algorithms it is the engine of the
+     *   worker being run (see ScopedEngine).
+     */
+    inline Engine & local(){
+      Engine * bound = detail::bound_engine();
+      return bound ? *bound : detail::thread_engine();
+    }
+
+    //! Seeds the engine of the calling thread
+    inline void seed(uint64_t seed){
+      local().seed(seed);
+    }
+
+    //! Seeds the engine of the calling thread from std::random_device
+    inline void seed_random(){
+      std::random_device device;
+      uint64_t seed = (static_cast<uint64_t>(device()) << 32) ^ device();
+      local().seed(seed);
+    }
+
+    /*! Makes local() return the given engine on this thread for the lifetime of the object
+     *
+     *  Example usage:
+     *  @code
+     *   Engine worker_rng(seed, worker);
+     *   {
+     *     ScopedEngine bind(worker_rng);
+     *     episode(...); // draws from worker_rng
+     *   }
+     *  @endcode
+     */
+    class ScopedEngine{
+    public:
+      explicit ScopedEngine(Engine & engine){
+        this->previous = detail::bound_engine();
+        detail::bound_engine() = &engine;
+      }
+
+      ~ScopedEngine(){
+        detail::bound_engine() = this->previous;
+      }
+
+    private:
+      ScopedEngine(const ScopedEngine &);
+      ScopedEngine & operator=(const ScopedEngine &);
+      Engine * previous;
+    };
+
+  }
+}
@@ -0,0 +1,236 @@
+/* Stopping criteria for Monte Carlo optimal control
+ *
+ * Copyright (C) 2016  Jarno Kiviaho <jarkki@kapsi.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+namespace mc{
+
+  namespace algorithms{
+
+    //! Why a Monte Carlo control run stopped
+    enum class StopReason{
+      iterations,     //!< max_iterations were run
+      policy_stable,  //!< the policy did not change for policy_stable_checks checks
+      q_converged,    //!< no Q-value changed more than q_tolerance between two checks
+      time_limit      //!< max_seconds of wall-clock time were used
+    };
+
+    /*! When to stop a Monte Carlo control run
+     *
+     *
+     *  The run always stops after max_iterations. The other criteria are off when zero. The policy
+     *   and Q-value criteria are checked every check_interval iterations, and not before
+     *   min_iterations.
+     *
+     *  Example usage:
+     *  @code
+     *   StoppingCriteria stop(60000000);
+     *   stop.policy_stable_checks = 5;   // no policy change in 5 x 10000 iterations
+     *   stop.max_seconds = 3600;
+     *   RunReport report;
+     *   tie(Q,pol) = run_mc_es(discrete_model, episode_es, stop, report);
+     *  @endcode
+     */
+    struct StoppingCriteria{
+
+      explicit StoppingCriteria(size_t max_iterations = 100000){
+        this->max_iterations = max_iterations;
+        this->check_interval = 10000;
+        this->min_iterations = 0;
+        this->policy_stable_checks = 0;
+        this->q_tolerance = 0.0;
+        this->max_seconds = 0.0;
+      }
+
+      //! Maximum # of iterations (episodes)
+      size_t max_iterations;
+
+      //! # of iterations between the checks of the policy and Q-value criteria
+      size_t check_interval;
+
+      //! The policy and Q-value criteria are not checked before this many iterations
+      size_t min_iterations;
+
+      //! Stop when the policy has not changed in this many consecutive checks (0 = off)
+      size_t policy_stable_checks;
+
+      //! Stop when no single Q-value update between two checks changed a Q-value by more than this (0 = off)
+      double q_tolerance;
+
+      //! Stop after this many seconds of wall-clock time (0 = off)
+      double max_seconds;
+    };
+
+    //! Summary of a Monte Carlo control run
+    struct RunReport{
+
+      RunReport(){
+        this->iterations = 0;
+        this->reason = StopReason::iterations;
+        this->seconds = 0.0;
+        this->checks = 0;
+        this->policy_changes = 0;
+        this->max_q_change = 0.0;
+      }
+
+      //! # of iterations (episodes) run
+      size_t iterations;
+
+      //! Why the run stopped
+      StopReason reason;
+
+      //! Wall-clock time of the run
+      double seconds;
+
+      //! # of checks of the policy and Q-value criteria
+      size_t checks;
+
+      //! # of policy changes between the last two checks
+      size_t policy_changes;
+
+      //! Largest change of a Q-value update between the last two checks
+      double max_q_change;
+
+      //! Name of the stop reason
+      string reason_name() const{
+        switch(this->reason){
+        case StopReason::iterations: return "iterations";
+        case StopReason::policy_stable: return "policy_stable";
+        case StopReason::q_converged: return "q_converged";
+        case StopReason::time_limit: return "time_limit";
+        }
+        return "unknown";
+      }
+    };
+
+    namespace detail{
+
+      /*! Keeps track of the stopping criteria during a run
+       *
+       *  The algorithms report every policy change and Q-value change, and ask done(iterations)
+       *   before every iteration (or every round of the parallel algorithms).
+       */
+      class StopMonitor{
+      public:
+
+        StopMonitor(const StoppingCriteria & stop, RunReport & report)
+          : stop(stop), report(report){
+          if(stop.check_interval == 0){
+            throw invalid_argument("StoppingCriteria: check_interval has to be positive");
+          }
+          this->start = chrono::steady_clock::now();
+          this->next_check = stop.check_interval;
+          this->next_time_check = time_check_interval;
+          this->stable_checks = 0;
+          this->policy_changes = 0;
+          this->max_q_change = 0.0;
+          this->report = RunReport();
+        }
+
+        //! Continues from a run that was stopped after the given # of iterations
+        void resume(const size_t & iterations){
+          this->next_check = iterations + this->stop.check_interval;
+          this->next_time_check = iterations + time_check_interval;
+        }
+
+        //! The policy of a state was changed
+        void policy_changed(){
+          this->policy_changes += 1;
+        }
+
+        //! A Q-value was changed by delta
+        void q_changed(const double & delta){
+          this->max_q_change = std::max(this->max_q_change, std::abs(delta));
+        }
+
+        //! Returns true if the run should stop after the given # of iterations, and fills in the report
+        bool done(const size_t & iterations){
+          if(iterations >= this->stop.max_iterations){
+            return this->finish(iterations, StopReason::iterations);
+          }
+
+          if(this->stop.max_seconds > 0.0 && iterations >= this->next_time_check){
+            this->next_time_check = iterations + time_check_interval;
+            if(this->elapsed() >= this->stop.max_seconds){
+              return this->finish(iterations, StopReason::time_limit);
+            }
+          }
+
+          if(iterations >= this->next_check){
+            this->next_check = iterations + this->stop.check_interval;
+            this->report.checks += 1;
+            this->report.policy_changes = this->policy_changes;
+            this->report.max_q_change = this->max_q_change;
+
+            this->stable_checks = this->policy_changes == 0 ? this->stable_checks + 1 : 0;
+            bool policy_stable = this->stop.policy_stable_checks > 0 && this->stable_checks >= this->stop.policy_stable_checks;
+            bool q_converged = this->stop.q_tolerance > 0.0 && this->max_q_change < this->stop.q_tolerance;
+
+            this->policy_changes = 0;
+            this->max_q_change = 0.0;
+
+            if(iterations >= this->stop.min_iterations){
+              if(policy_stable){
+                return this->finish(iterations, StopReason::policy_stable);
+              }
+              if(q_converged){
+                return this->finish(iterations, StopReason::q_converged);
+              }
+            }
+          }
+          return false;
+        }
+
+      private:
+
+        // Reading the clock costs more than an iteration of a simple model
+        static const size_t time_check_interval = 1024;
+
+        bool finish(size_t iterations, StopReason reason){
+          this->report.iterations = iterations;
+          this->report.reason = reason;
+          this->report.seconds = this->elapsed();
+          return true;
+        }
+
+        double elapsed() const{
+          return chrono::duration<double>(chrono::steady_clock::now() - this->start).count();
+        }
+
+        const StoppingCriteria & stop;
+        RunReport & report;
+        chrono::steady_clock::time_point start;
+        size_t next_check;
+        size_t next_time_check;
+        size_t stable_checks;
+        size_t policy_changes;
+        double max_q_change;
+      };
+    }
+
+  }
+}
@@ -20,77 +20,124 @@
 #pragma once
 
 #include <tuple>
-#include <tuple>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <exception>
+#include <string>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
 #include <boost/range/irange.hpp>
 #include "armadillo"
+#include "mc-control/rng.hpp"
 
 using namespace std;
 using namespace arma;
+using mc::rng::Engine;
 
 namespace mc{
 
   namespace utils{
 
+    // All draws come from the engine of the calling thread, mc::rng::local(), unless an engine
+    //  is given explicitly. See mc-control/rng.hpp.
+
     //! Matrix of x ~ U(a,b) size (n_rows,n_cols)
     mat uniform(const double a, const double b, const size_t n_rows, size_t n_cols){
-      return a + (b-a)*randu(n_rows,n_cols);
+      mat result(n_rows,n_cols);
+      Engine & rng = mc::rng::local();
+      for(auto & x : result){
+        x = rng.uniform(a,b);
+      }
+      return result;
     }
 
     //! Vector of x ~ U(a,b) size n
     vec uniform(const double a, const double b, const size_t n){
-      return a + (b-a)*randu(n);
+      vec result(n);
+      Engine & rng = mc::rng::local();
+      for(auto & x : result){
+        x = rng.uniform(a,b);
+      }
+      return result;
     }
 
     //! Matrix of x ~ U(a,b) size (n_rows,n_cols)
     mat uniform(const double a, const double b, const SizeMat sizemat){
-      return a + (b-a)*randu(sizemat);
+      return uniform(a, b, sizemat.n_rows, sizemat.n_cols);
     }
 
     //! Matrix of x ~ U(0,1) size (n_rows,n_cols)
     mat uniform(const size_t & n_rows, const size_t & n_cols){
-      return randu(n_rows,n_cols);
+      mat result(n_rows,n_cols);
+      mc::rng::local().uniform(result.memptr(), result.n_elem);
+      return result;
     }
     //! vector of x ~ U(0,1) size n
     vec uniform(const size_t & n){
-      return randu(n);
+      vec result(n);
+      mc::rng::local().uniform(result.memptr(), result.n_elem);
+      return result;
     }
 
     //! Single draw from U(0,1)
     double uniform(){
-      vec u = randu(1);
-      return u(0);
+      return mc::rng::local().uniform();
+    }
+
+    //! Single draw from U(0,1) with the given engine
+    double uniform(Engine & rng){
+      return rng.uniform();
     }
 
     //! Matrix of x ~ N(mu,sigma) size (n_rows,n_cols)
     mat norm(const double mu, const double sigma, const int n_rows, int n_cols){
-      return mu + sigma*randn(n_rows,n_cols);
+      mat result(n_rows,n_cols);
+      Engine & rng = mc::rng::local();
+      for(auto & x : result){
+        x = rng.norm(mu,sigma);
+      }
+      return result;
     }
 
     //! Matrix of x ~ N(0,1) size (n_rows,n_cols)
     mat norm(const size_t & n_rows, const size_t & n_cols){
-      return randn(n_rows,n_cols);
+      mat result(n_rows,n_cols);
+      mc::rng::local().norm(result.memptr(), result.n_elem);
+      return result;
     }
 
     //! Vector of x ~ N(0,1) size n
     vec norm(const size_t &n){
-      return randn(n);
+      vec result(n);
+      mc::rng::local().norm(result.memptr(), result.n_elem);
+      return result;
     }
 
     //! Single draw from N(0,1)
     double norm(){
+      return mc::rng::local().norm();
+    }
 
-      vec n = randn(1);
-      return n(0);
+    //! Single draw from N(0,1) with the given engine
+    double norm(Engine & rng){
+      return rng.norm();
     }
 
     //! Random integer in [a,b]
     int randint(int a, int b){
-      return randi<vec>(1,distr_param(a,b))(0);
+      return mc::rng::local().randint(a,b);
     }
 
     // Random integer in [0,n-1]
     size_t randint(const size_t & n){
-      return randi<vec>(1,distr_param(0,static_cast<int>(n-1)))(0);
+      return mc::rng::local().randint(static_cast<uint64_t>(n));
+    }
+
+    // Random integer in [0,n-1] with the given engine
+    size_t randint(Engine & rng, const size_t & n){
+      return rng.randint(static_cast<uint64_t>(n));
     }
 
     /*! Integer range in [0,upper-1]
@@ -138,6 +185,68 @@ namespace mc{
       return boost::irange(static_cast<T2>(lower), upper);
     }
 
+    //! Number of hardware threads (at least one)
+    size_t hardware_threads(){
+      size_t n = std::thread::hardware_concurrency();
+      return n > 0 ? n : 1;
+    }
+
+    /*! Calls f(begin, end) on contiguous blocks of [0,n) from several threads
+     *
+     *
+     *  Splits [0,n) into at most nthreads blocks of equal size and runs the blocks on their own
+     *   threads. Returns when all the blocks are done. An exception thrown in a block is rethrown
+     *   in the calling thread.
+     *
+     *  @param n        # of items
+     *  @param f        function (size_t begin, size_t end) processing the items [begin,end)
+     *  @param nthreads maximum # of threads (0 = one per hardware thread)
+     *
+     *  Example usage:
+     *  @code
+     *   parallel_for(x.size(), [&](size_t begin, size_t end){
+     *     for(size_t i = begin; i < end; ++i){
+     *       y(i) = f(x(i));
+     *     }
+     *   });
+     *  @endcode
+     */
+    template<typename FuncT>
+    void parallel_for(const size_t & n, FuncT f, size_t nthreads = 0){
+      if(nthreads == 0){
+        nthreads = hardware_threads();
+      }
+      nthreads = std::min(nthreads, n);
+      if(nthreads <= 1){
+        if(n > 0){
+          f(static_cast<size_t>(0), n);
+        }
+        return;
+      }
+
+      vector<thread> threads;
+      vector<exception_ptr> errors(nthreads);
+      for(size_t t = 0; t < nthreads; ++t){
+        size_t begin = n * t / nthreads;
+        size_t end = n * (t + 1) / nthreads;
+        threads.push_back(thread([&f, &errors, t, begin, end](){
+              try{
+                f(begin, end);
+              }catch(...){
+                errors[t] = current_exception();
+              }
+            }));
+      }
+      for(auto & t : threads){
+        t.join();
+      }
+      for(auto & error : errors){
+        if(error){
+          rethrow_exception(error);
+        }
+      }
+    }
+
     /*! Combinations of integer ranges
      *
      *  Calculates all combinations of integer ranges of which the length is given in the input vector.
@@ -173,6 +282,74 @@ namespace mc{
       return result;
     };
 
+    /*! Flat indexing of the states of a discretized state space
+     *
+     *
+     *  A state is a bin index for each state variable. The flat index is the mixed-radix number
+     *   with the last variable changing fastest, i.e. the row of the state in combinations(dim):
+     *
+     *    index = sum_i bin_i * stride_i,  stride_i = prod(dim(i+1), ..., dim(nvariables-1))
+     *
+     *  Encoding and decoding are O(nvariables) and do not allocate.
+     */
+    class StateIndexer{
+    public:
+
+      StateIndexer(){
+        this->nstates = 0;
+      }
+
+      /*! Constructor
+       *
+       *  @param dim vector of # of bins for each variable
+       */
+      StateIndexer(const uvec & dim){
+        size_t nvariables = dim.size();
+        this->dim.resize(nvariables);
+        this->strides.resize(nvariables);
+        size_t stride = 1;
+        for(size_t i = nvariables; i-- > 0;){
+          this->dim[i] = dim(i);
+          this->strides[i] = stride;
+          stride *= dim(i);
+        }
+        this->nstates = stride;
+      }
+
+      //! Flat index of the state with bin indices bins[0..nvariables-1]
+      size_t encode(const size_t * bins) const{
+        size_t index = 0;
+        for(size_t i = 0; i < this->strides.size(); ++i){
+          index += bins[i] * this->strides[i];
+        }
+        return index;
+      }
+
+      //! Flat index of the state with the given bin indices
+      size_t encode(const vector<size_t> & bins) const{
+        return this->encode(bins.data());
+      }
+
+      //! Writes the bin indices of the state with the given flat index to bins[0..nvariables-1]
+      void decode(size_t index, size_t * bins) const{
+        for(size_t i = 0; i < this->strides.size(); ++i){
+          bins[i] = index / this->strides[i];
+          index -= bins[i] * this->strides[i];
+        }
+      }
+
+      //! Bin indices of the state with the given flat index
+      vector<size_t> decode(const size_t & index) const{
+        vector<size_t> bins(this->strides.size());
+        this->decode(index, bins.data());
+        return bins;
+      }
+
+      size_t nstates;
+      vector<size_t> dim;
+      vector<size_t> strides;
+    };
+
     /*! Inverse uniform cdf sampling to sample from discrete distribution
      *
      *
@@ -231,10 +408,10 @@ namespace mc{
 
       vector<uvec> possible;
       for(auto state : range(discrete_model.state_space_size)){
-        vec state_value = discrete_model.state_values.row(state);
         vector<size_t> possible_for_state;
+        auto value = discrete_model.state_value(state);
         for(auto action : range(discrete_model.actions.size())){
-          if(discrete_model.model.constraint(discrete_model.actions(action), state_value)){
+          if(discrete_model.model.constraint(discrete_model.actions(action), value)){
             possible_for_state.push_back(action);
           }
         }
@@ -245,35 +422,389 @@ namespace mc{
 
     }
 
-    /*! Returns the action that maximizes the Q-value for the given state
+    /*! First-visit marks for the state, action pairs of an episode
+     *
      *
+     *  Each pair is stamped with the number of the episode it was last seen in, so starting a new
+     *   episode is a counter increment instead of zeroing the whole (nstates x nactions) table.
+     *   The per-episode cost is proportional to the episode length.
+     *
+     *  Example usage:
+     *  @code
+     *   FirstVisitTracker visits(nstates, nactions);
+     *   visits.new_episode();
+     *   if(visits.first_visit(s,a)){
+     *     // update returns for (s,a)
+     *   }
+     *  @endcode
      */
-    size_t argmax_q(const mat & Q, const size_t &state, const uvec & possible_a){
+    class FirstVisitTracker{
+    public:
 
-      // There might be several actions that give the max Q-value
-      vector<size_t> maxq_actions;
+      FirstVisitTracker(){
+        this->nactions = 0;
+        this->episode = 0;
+      }
 
-      // Calculate the max Q-value for this state and actions possible from here
-      double maxq = Q(state, possible_a(0));
-      for(auto i : range(1,possible_a.size())){
-        if(Q(state,possible_a(i)) > maxq){
-          maxq = Q(state,possible_a(i));
+      FirstVisitTracker(const size_t & nstates, const size_t & nactions){
+        this->nactions = nactions;
+        this->episode = 0;
+        this->stamps.assign(nstates * nactions, 0);
+      }
+
+      //! Starts a new episode, forgetting all the previous visits
+      void new_episode(){
+        this->episode += 1;
+        // Stamps wrapped around, old stamps could collide with the new ones
+        if(this->episode == 0){
+          std::fill(this->stamps.begin(), this->stamps.end(), 0);
+          this->episode = 1;
         }
       }
-      // Check if there are several actions with same q-value as maxq
-      for(auto i : range(possible_a.size())){
-        if (Q(state,possible_a(i)) == maxq){
-          maxq_actions.push_back(possible_a(i));
+
+      //! Returns true if (state, action) has not been visited in this episode and marks it visited
+      bool first_visit(const size_t & state, const size_t & action){
+        unsigned int & stamp = this->stamps[state * this->nactions + action];
+        if(stamp == this->episode){
+          return false;
+        }
+        stamp = this->episode;
+        return true;
+      }
+
+    private:
+      size_t nactions;
+      unsigned int episode;
+      vector<unsigned int> stamps;
+    };
+
+    /*! First-visit marks in a hash set of the pairs of the current episode
+     *
+     *
+     *  Same as FirstVisitTracker, but the memory is proportional to the longest episode instead of
+     *   the number of state, action pairs, for state spaces too large for a table of stamps. The set
+     *   is open-addressed on state * nactions + action and its slots are stamped with the episode,
+     *   so starting a new episode is again a counter increment.
+     */
+    class HashedVisitTracker{
+    public:
+
+      HashedVisitTracker(){
+        this->init(0, 16);
+      }
+
+      //! @param capacity initial # of slots, grows to twice the # of pairs of the longest episode
+      explicit HashedVisitTracker(const size_t & nactions, const size_t & capacity = 64){
+        size_t slots = 16;
+        while(slots < capacity){
+          slots *= 2;
         }
+        this->init(nactions, slots);
       }
 
-      // Return the single action that maximizes the Q-value or
-      //  randomly one of the actions that maximize the Q-value.
-      if(maxq_actions.size() > 1){
-        return maxq_actions[randint(maxq_actions.size())];
-      }else{
-        return maxq_actions[0];
+      //! Starts a new episode, forgetting all the previous visits
+      void new_episode(){
+        this->episode += 1;
+        this->size = 0;
+        if(this->episode == 0){
+          std::fill(this->stamps.begin(), this->stamps.end(), 0);
+          this->episode = 1;
+        }
+      }
+
+      //! Returns true if (state, action) has not been visited in this episode and marks it visited
+      bool first_visit(const size_t & state, const size_t & action){
+        uint64_t key = static_cast<uint64_t>(state) * this->nactions + action;
+        size_t i = this->slot(key);
+        while(this->stamps[i] == this->episode){
+          if(this->keys[i] == key){
+            return false;
+          }
+          i = (i + 1) & this->mask;
+        }
+        this->keys[i] = key;
+        this->stamps[i] = this->episode;
+        this->size += 1;
+        if(2 * this->size > this->keys.size()){
+          this->grow();
+        }
+        return true;
+      }
+
+    private:
+
+      void init(size_t nactions, size_t nslots){
+        this->nactions = nactions;
+        this->episode = 1;
+        this->size = 0;
+        this->keys.assign(nslots, 0);
+        this->stamps.assign(nslots, 0);
+        this->mask = nslots - 1;
+        this->shift = 64;
+        for(size_t n = nslots; n > 1; n /= 2){
+          this->shift -= 1;
+        }
+      }
+
+      //! Home slot of a key, from the high bits of a Fibonacci hash
+      size_t slot(uint64_t key) const{
+        return static_cast<size_t>((key * 0x9e3779b97f4a7c15ull) >> this->shift);
+      }
+
+      //! Doubles the slots, keeping the pairs of the current episode
+      void grow(){
+        vector<uint64_t> old_keys;
+        vector<unsigned int> old_stamps;
+        old_keys.swap(this->keys);
+        old_stamps.swap(this->stamps);
+        unsigned int episode = this->episode;
+        this->init(this->nactions, 2 * old_keys.size());
+        this->episode = episode;
+        for(size_t j = 0; j < old_keys.size(); ++j){
+          if(old_stamps[j] == episode){
+            size_t i = this->slot(old_keys[j]);
+            while(this->stamps[i] == episode){
+              i = (i + 1) & this->mask;
+            }
+            this->keys[i] = old_keys[j];
+            this->stamps[i] = episode;
+            this->size += 1;
+          }
+        }
+      }
+
+      size_t nactions;
+      unsigned int episode;
+      size_t size;
+      size_t mask;
+      unsigned int shift;
+      vector<uint64_t> keys;
+      vector<unsigned int> stamps;
+    };
+
+    /*! Feasible actions of every state
+     *
+     *
+     *  Most constraints make the feasible actions of a state a contiguous range of the action grid
+     *   (e.g. action <= state in the optimal growth model is a prefix), so each state is stored as a
+     *   range [lo,hi). States whose feasible actions are not contiguous are stored as bitmasks
+     *   instead, one bit per action. Either way the memory is a few words per state and nothing is
+     *   allocated when the sets are used.
+     *
+     *  Example usage:
+     *  @code
+     *   FeasibleActions feasible = create_feasible_actions(discrete_model);
+     *   size_t action = feasible.random_action(state);
+     *  @endcode
+     */
+    class FeasibleActions{
+    public:
+
+      FeasibleActions(){
+        this->nstates = 0;
+        this->nactions = 0;
+        this->nwords = 0;
+      }
+
+      /*! Constructor
+       *
+       *  @param nstates    # of states
+       *  @param nactions   # of actions
+       *  @param is_feasible function (state, action) returning true if the action can be taken in the state
+       */
+      template<typename FeasibleFuncT>
+      FeasibleActions(const size_t & nstates, const size_t & nactions, FeasibleFuncT is_feasible){
+        this->nstates = nstates;
+        this->nactions = nactions;
+        this->nwords = (nactions + 63) / 64;
+        this->lo.resize(nstates);
+        this->hi.resize(nstates);
+        this->nfeasible.resize(nstates);
+        this->mask_index.assign(nstates, no_mask);
+
+        vector<uint64_t> mask(this->nwords);
+        for(size_t state = 0; state < nstates; ++state){
+          std::fill(mask.begin(), mask.end(), 0);
+          size_t first = nactions, last = 0, count = 0;
+          for(size_t action = 0; action < nactions; ++action){
+            if(is_feasible(state, action)){
+              mask[action / 64] |= static_cast<uint64_t>(1) << (action % 64);
+              first = std::min(first, action);
+              last = action + 1;
+              count += 1;
+            }
+          }
+          if(count == 0){
+            throw invalid_argument("FeasibleActions: state " + to_string(state) + " has no feasible actions");
+          }
+          this->lo[state] = first;
+          this->hi[state] = last;
+          this->nfeasible[state] = count;
+
+          // Not a contiguous range, keep the bitmask
+          if(count != last - first){
+            this->mask_index[state] = this->masks.size() / this->nwords;
+            this->masks.insert(this->masks.end(), mask.begin(), mask.end());
+          }
+        }
+      }
+
+      //! Feasible actions from possible actions vectors (as created by create_possible_actions_matrix)
+      FeasibleActions(const vector<uvec> & possible_actions, const size_t & nactions)
+        : FeasibleActions(possible_actions.size(), nactions, ActionListFeasible(possible_actions, nactions)){}
+
+      //! Number of feasible actions in the state
+      size_t size(const size_t & state) const{
+        return this->nfeasible[state];
+      }
+
+      //! True if the feasible actions of the state are the range [lo(state), hi(state))
+      bool is_range(const size_t & state) const{
+        return this->mask_index[state] == no_mask;
+      }
+
+      //! Bitmask words of a non-range state (see is_range)
+      const uint64_t * mask(const size_t & state) const{
+        return this->masks.data() + this->mask_index[state] * this->nwords;
+      }
+
+      //! True if the action can be taken in the state
+      bool contains(const size_t & state, const size_t & action) const{
+        if(action < this->lo[state] || action >= this->hi[state]){
+          return false;
+        }
+        if(this->is_range(state)){
+          return true;
+        }
+        return (this->mask(state)[action / 64] >> (action % 64)) & 1;
+      }
+
+      //! The k:th (from 0) feasible action of the state
+      size_t action(const size_t & state, size_t k) const{
+        if(this->is_range(state)){
+          return this->lo[state] + k;
+        }
+        const uint64_t * words = this->mask(state);
+        for(size_t w = 0; w < this->nwords; ++w){
+          size_t bits = __builtin_popcountll(words[w]);
+          if(k < bits){
+            uint64_t word = words[w];
+            for(; k > 0; --k){
+              word &= word - 1;
+            }
+            return w * 64 + __builtin_ctzll(word);
+          }
+          k -= bits;
+        }
+        throw out_of_range("FeasibleActions::action: k is larger than the number of feasible actions");
+      }
+
+      //! A uniformly random feasible action of the state
+      size_t random_action(const size_t & state) const{
+        return this->action(state, randint(this->nfeasible[state]));
+      }
+
+      //! The feasible actions of the state as a vector
+      uvec to_uvec(const size_t & state) const{
+        uvec actions(this->nfeasible[state]);
+        for(size_t k = 0; k < actions.size(); ++k){
+          actions(k) = this->action(state, k);
+        }
+        return actions;
+      }
+
+      size_t nstates;
+      size_t nactions;
+      vector<uint32_t> lo;
+      vector<uint32_t> hi;
+
+    private:
+      enum : uint32_t { no_mask = 0xffffffffu };
+
+      // Feasibility from a list of possible actions for each state
+      struct ActionListFeasible{
+        ActionListFeasible(const vector<uvec> & possible_actions, size_t nactions){
+          this->possible_actions = &possible_actions;
+          this->nactions = nactions;
+        }
+        bool operator()(size_t state, size_t action){
+          // Called with increasing actions for each state, keep the position in the list
+          if(state != this->state || action == 0){
+            this->state = state;
+            this->position = 0;
+          }
+          const uvec & actions = (*this->possible_actions)[state];
+          while(this->position < actions.size() && actions(this->position) < action){
+            this->position += 1;
+          }
+          return this->position < actions.size() && actions(this->position) == action;
+        }
+        const vector<uvec> * possible_actions;
+        size_t nactions;
+        size_t state = 0;
+        size_t position = 0;
+      };
+
+      size_t nwords;
+      vector<uint32_t> nfeasible;
+      vector<uint32_t> mask_index;
+      vector<uint64_t> masks;
+    };
+
+    /*! Returns the feasible actions of every state of a discretized model
+     *
+     */
+    template<typename DiscretizedModelT>
+    FeasibleActions create_feasible_actions(const DiscretizedModelT & discrete_model){
+      // The actions of a state are checked one after the other, compute its value once
+      typename std::decay<decltype(discrete_model.state_value(0))>::type value;
+      size_t value_state = discrete_model.state_space_size;
+      return FeasibleActions(discrete_model.state_space_size, discrete_model.actions.size(),
+                             [&](size_t state, size_t action){
+                               if(state != value_state){
+                                 value = discrete_model.state_value(state);
+                                 value_state = state;
+                               }
+                               return discrete_model.model.constraint(discrete_model.actions(action), value);
+                             });
+    }
+
+    /*! Returns a random policy, given the feasible actions for each state.
+     *
+     */
+    uvec create_random_policy(const FeasibleActions & feasible){
+      uvec pol(feasible.nstates);
+      for(auto state : range(feasible.nstates)){
+        pol(state) = feasible.random_action(state);
+      }
+      return pol;
+    }
+
+    /*! Returns the action that maximizes the Q-value for the given state
+     *
+     *  Ties are broken uniformly at random (reservoir sampling in a single pass, no allocations).
+     */
+    size_t argmax_q(const mat & Q, const size_t &state, const uvec & possible_a){
+
+      // Calculate the max Q-value for this state and actions possible from here
+      size_t best = possible_a(0);
+      double maxq = Q(state, best);
+      size_t nties = 1;
+      for(auto i : range(1,possible_a.size())){
+        double q = Q(state,possible_a(i));
+        if(q > maxq){
+          maxq = q;
+          best = possible_a(i);
+          nties = 1;
+        }else if(q == maxq){
+          // Keep each of the actions with the max Q-value with equal probability
+          nties += 1;
+          if(randint(nties) == 0){
+            best = possible_a(i);
+          }
+        }
       }
+      return best;
     }
 
   }
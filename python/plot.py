@@ -0,0 +1,102 @@
+#  Plots the Q-values, the policy and the transition densities exported by
+#   mc::plot::export_q and mc::plot::export_distributions.
+#
+#  Usage:
+#
+#    python python/plot.py q q_values.npz [-o q_values.png]
+#    python python/plot.py distributions distributions.npz [-o distributions.png] [--variable 0]
+#
+#  With -o the figure is saved without opening a window, so this also works
+#   on machines without a display.
+#
+#  Requires numpy and matplotlib.
+#
+import argparse
+import sys
+
+import numpy as np
+
+
+def plot_q(plt, data):
+    """Contours of the Q-values with the policy for one state variable, the
+    policy as an image for two."""
+    Q = data['Q']
+    actions = data['actions']
+    policy_actions = data['policy_actions']
+    nbins = data['nbins']
+
+    if len(nbins) == 1:
+        state_values = data['bin_values_0']
+        X, Y = np.meshgrid(state_values, actions)
+        plt.contourf(X, Y, Q.T, cmap=plt.get_cmap('summer'))
+        plt.colorbar(label='Q-value')
+        plt.plot(state_values, policy_actions, color='#A0522D', label='Optimal policy')
+        plt.xlabel('State')
+        plt.ylabel('Action')
+        plt.title('Q-value')
+        plt.legend(loc='upper left')
+    elif len(nbins) == 2:
+        x = data['bin_values_0']
+        y = data['bin_values_1']
+        # The last state variable changes fastest in the state index
+        policy = policy_actions.reshape(nbins[0], nbins[1])
+        plt.imshow(policy.T, origin='lower', aspect='auto',
+                   extent=[x[0], x[-1], y[0], y[-1]], cmap=plt.get_cmap('summer'))
+        plt.colorbar(label='Action')
+        plt.xlabel('State variable 0')
+        plt.ylabel('State variable 1')
+        plt.title('Optimal policy')
+    else:
+        sys.exit('Plotting Q-values only works for one or two state variables')
+
+
+def plot_distributions(plt, data, variable):
+    """Density of a state variable after each action, as bars."""
+    from mpl_toolkits.mplot3d import Axes3D  # noqa: F401, registers the 3d projection
+
+    key = 'densities_%d' % variable
+    if key not in data:
+        sys.exit('No state variable %d in the file' % variable)
+    densities = data[key]
+    bins = data['bins_%d' % variable]
+    actions = data['actions']
+
+    ax = plt.figure().add_subplot(111, projection='3d')
+    colors = [c['color'] for c in plt.rcParams['axes.prop_cycle']]
+    width = bins[1] - bins[0]
+    for i, action in enumerate(actions):
+        ax.bar(bins[:-1], densities[i], np.zeros(len(bins) - 1) + action, zdir='y',
+               alpha=0.8, color=colors[i % len(colors)], width=width)
+    ax.set_xlabel('State')
+    ax.set_ylabel('Action')
+    ax.set_zlabel('Density')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Plot the results of mc-control')
+    parser.add_argument('kind', choices=['q', 'distributions'])
+    parser.add_argument('path', help='.npz file written by export_q or export_distributions')
+    parser.add_argument('-o', '--output', help='save the figure into this file instead of showing it')
+    parser.add_argument('--variable', type=int, default=0, help='state variable of the densities')
+    args = parser.parse_args()
+
+    import matplotlib
+    if args.output:
+        matplotlib.use('Agg')
+    import matplotlib.pyplot as plt
+    plt.style.use('ggplot')
+
+    data = np.load(args.path)
+    if args.kind == 'q':
+        plot_q(plt, data)
+    else:
+        plot_distributions(plt, data, args.variable)
+
+    if args.output:
+        plt.savefig(args.output, dpi=150)
+    else:
+        plt.show()
+
+
+if __name__ == '__main__':
+    main()